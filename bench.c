@@ -0,0 +1,440 @@
+/* For copyright notice, see oscar.h. */
+
+/* Synthetic GC benchmarks. Each workload runs in its own process (so
+ * peak RSS is its own), and prints one result per line, as CSV (the
+ * default) or JSON lines, for tracking over time.
+ *
+ * Usage: bench_oscar [-f csv|json] [-s SCALE] [WORKLOAD...]
+ *   -f    output format
+ *   -s    multiply every workload's allocation count by SCALE
+ * With no WORKLOAD names, every workload is run. */
+
+#define _DEFAULT_SOURCE         /* for clock_gettime, getrusage, fork */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "oscar.h"
+#include "oscar_inline.h"
+#include "oscar_profile.h"
+
+#define MAX_EDGES 4
+
+/* Every workload's cells start with up to MAX_EDGES references,
+ * OSCAR_ID_NONE if unused, followed by PAD bytes of padding. */
+typedef struct node {
+    pool_id edge[MAX_EDGES];
+} node;
+
+typedef enum { LIST, TREE, GRAPH } shape;
+
+typedef struct workload {
+    const char *name;
+    shape shape;
+    int fixed;                  /* fixed-size pool? */
+    size_t pad;                 /* extra bytes per cell */
+    size_t live;                /* list length, tree or graph size */
+    size_t fixed_count;         /* cells, for fixed pools */
+    size_t allocs;              /* allocations to make, before scaling */
+    int epoch;                  /* use epoch marks? */
+    int inline_get;             /* oscar_get_inline, not _unchecked? */
+    size_t profile;             /* profile 1 in this many allocs, or 0 */
+} workload;
+
+static const workload workloads[] = {
+    { "list",           LIST,  0, 0,    10000,   0,      2000000, 0 },
+    { "list_fixed",     LIST,  1, 0,    10000,   20000,  2000000, 0 },
+    { "list_high_live", LIST,  1, 0,    18000,   20000,  2000000, 0 },
+    { "list_low_live",  LIST,  1, 0,    2000,    20000,  2000000, 0 },
+    { "list_pad64",     LIST,  0, 64,   10000,   0,      2000000, 0 },
+    { "list_pad256",    LIST,  0, 256,  10000,   0,      1000000, 0 },
+    { "tree",           TREE,  0, 0,    16,      0,      2000000, 0 },
+    { "graph",          GRAPH, 0, 0,    4096,    0,      2000000, 0 },
+    /* Mostly live heaps, with plain and epoch marks: the sweep passes
+     * whole words of live cells, so resetting marks costs the most. */
+    { "list_high_live_epoch", LIST, 1, 0, 18000, 20000,  2000000, 1 },
+    { "big_live",       LIST,  1, 0,    950000,  1000000, 4000000, 0 },
+    { "big_live_epoch", LIST,  1, 0,    950000,  1000000, 4000000, 1 },
+    { "tree_epoch",     TREE,  0, 0,    16,      0,      2000000, 1 },
+    /* The same, with every cell looked up through the bounds-checked
+     * inline get, which should cost no more than the unchecked one. */
+    { "tree_get_inline", TREE, 0, 0,    16,      0,      2000000, 0, 1 },
+    { "big_live_get_inline", LIST, 1, 0, 950000, 1000000, 4000000, 0, 1 },
+    /* Lifetime profiling, sampling every allocation or 1 in 64, to
+     * compare with graph. */
+    { "graph_profile",  GRAPH, 0, 0,    4096,    0,      2000000, 0, 0, 1 },
+    { "graph_profile_64", GRAPH, 0, 0,  4096,    0,      2000000, 0, 0, 64 },
+};
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+typedef struct bench {
+    oscar *p;
+    pool_id *roots;             /* root set */
+    size_t root_count;
+    pool_id *stack;             /* marking work list */
+    size_t stack_sz;
+    uint64_t rng;
+    int collected;              /* did the last alloc run mark_cb? */
+    int inline_get;             /* look cells up with oscar_get_inline? */
+
+    size_t allocs;
+    size_t collections;
+    uint64_t mark_ns;           /* time in mark_cb */
+    uint64_t sweep_ns;          /* time in oscar_alloc, outside mark_cb */
+    uint64_t *pauses;           /* durations of allocs that collected */
+    size_t pause_count;
+    size_t pause_sz;
+
+    struct pending *todo;       /* tree nodes still to build */
+    size_t todo_sz;
+} bench;
+
+/* A tree node to allocate, as child EDGE of PARENT. */
+typedef struct pending {
+    pool_id parent;
+    unsigned int edge;
+    unsigned int depth;         /* levels from here down */
+} pending;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t rng_next(bench *b) {  /* xorshift64 */
+    b->rng ^= b->rng << 13;
+    b->rng ^= b->rng >> 7;
+    b->rng ^= b->rng << 17;
+    return b->rng;
+}
+
+static void *grow_array(void *a, size_t *sz, size_t elt) {
+    size_t nsz = (*sz == 0 ? 1024 : 2 * *sz);
+    void *na = realloc(a, nsz * elt);
+    if (na == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    *sz = nsz;
+    return na;
+}
+
+static node *get(bench *b, pool_id id) {
+    if (b->inline_get) return (node *) oscar_get_inline(b->p, id);
+    return (node *) oscar_get_unchecked(b->p, id);
+}
+
+/* Mark everything reachable from the roots, with an explicit stack. */
+static int mark_graph(oscar *p, void *udata) {
+    bench *b = (bench *) udata;
+    size_t top = 0, i = 0;
+    uint64_t t0 = now_ns();
+
+    for (i = 0; i < b->root_count; i++) {
+        pool_id id = b->roots[i];
+        if (id == OSCAR_ID_NONE || !oscar_mark_inline(p, id)) continue;
+        if (top == b->stack_sz) {
+            b->stack = grow_array(b->stack, &b->stack_sz, sizeof(pool_id));
+        }
+        b->stack[top++] = id;
+    }
+    while (top > 0) {
+        node *n = get(b, b->stack[--top]);
+        for (i = 0; i < MAX_EDGES; i++) {
+            pool_id id = n->edge[i];
+            if (id == OSCAR_ID_NONE || !oscar_mark_inline(p, id)) continue;
+            if (top == b->stack_sz) {
+                b->stack = grow_array(b->stack, &b->stack_sz, sizeof(pool_id));
+            }
+            b->stack[top++] = id;
+        }
+    }
+
+    b->mark_ns += now_ns() - t0;
+    b->collections++;
+    b->collected = 1;
+    return 0;
+}
+
+/* Allocate a cell with no edges, timing it. */
+static pool_id bench_alloc(bench *b) {
+    uint64_t t0 = 0, mark0 = b->mark_ns, dt = 0;
+    pool_id id = OSCAR_ID_NONE;
+    node *n = NULL;
+    int i = 0;
+
+    b->collected = 0;
+    t0 = now_ns();
+    id = oscar_alloc(b->p);
+    dt = now_ns() - t0;
+    if (id == OSCAR_ID_NONE) {
+        fprintf(stderr, "allocation failed\n");
+        exit(1);
+    }
+
+    b->sweep_ns += dt - (b->mark_ns - mark0);
+    if (b->collected) {
+        if (b->pause_count == b->pause_sz) {
+            b->pauses = grow_array(b->pauses, &b->pause_sz, sizeof(uint64_t));
+        }
+        b->pauses[b->pause_count++] = dt;
+    }
+    b->allocs++;
+
+    n = get(b, id);
+    for (i = 0; i < MAX_EDGES; i++) n->edge[i] = OSCAR_ID_NONE;
+    return id;
+}
+
+/* Queue both children of PARENT, whose subtrees have DEPTH levels. */
+#define PUSH_CHILDREN(B, TOP, PARENT, DEPTH) {                          \
+        unsigned int e_ = 0;                                            \
+        for (e_ = 0; e_ < 2; e_++) {                                    \
+            if ((TOP) == (B)->todo_sz) {                                \
+                (B)->todo = grow_array((B)->todo, &(B)->todo_sz,        \
+                    sizeof(pending));                                   \
+            }                                                           \
+            (B)->todo[TOP].parent = (PARENT);                           \
+            (B)->todo[TOP].edge = e_;                                   \
+            (B)->todo[TOP].depth = (DEPTH);                             \
+            (TOP)++;                                                    \
+        }                                                               \
+    }
+
+/* A FIFO linked list of W->LIVE cells: each new cell is appended, and
+ * the oldest dropped, so every cell lives for W->LIVE allocations. */
+static void run_list(bench *b, const workload *w, size_t allocs) {
+    pool_id tail = OSCAR_ID_NONE;
+    size_t len = 0;
+    b->roots[0] = OSCAR_ID_NONE;
+    b->root_count = 1;
+
+    while (b->allocs < allocs) {
+        pool_id id = bench_alloc(b);
+        if (tail == OSCAR_ID_NONE) {
+            b->roots[0] = id;
+        } else {
+            get(b, tail)->edge[0] = id;
+        }
+        tail = id;
+        if (++len > w->live) {
+            b->roots[0] = get(b, b->roots[0])->edge[0];
+            len--;
+        }
+    }
+}
+
+/* Build a complete binary tree of DEPTH levels, rooted at ROOTS[SLOT].
+ * Nodes are allocated top-down, and each is linked to its parent right
+ * away, so the partial tree is always reachable from the root. */
+static void build_tree(bench *b, size_t slot, unsigned int depth) {
+    size_t top = 0;
+    b->roots[slot] = bench_alloc(b);
+    if (depth > 1) {
+        PUSH_CHILDREN(b, top, b->roots[slot], depth - 1);
+    }
+    while (top > 0) {
+        pending t = b->todo[--top];
+        pool_id id = bench_alloc(b);
+        get(b, t.parent)->edge[t.edge] = id;
+        if (t.depth > 1) {
+            PUSH_CHILDREN(b, top, id, t.depth - 1);
+        }
+    }
+}
+
+/* One long-lived tree of W->LIVE levels, then short-lived trees of
+ * 10 levels, as in the classic GCBench. */
+static void run_tree(bench *b, const workload *w, size_t allocs) {
+    b->roots[0] = b->roots[1] = OSCAR_ID_NONE;
+    b->root_count = 2;
+    build_tree(b, 0, (unsigned int) w->live);
+    while (b->allocs < allocs) {
+        build_tree(b, 1, 10);
+        b->roots[1] = OSCAR_ID_NONE;
+    }
+}
+
+/* A random graph: W->LIVE root slots, each replaced in turn by a new
+ * node with edges to random roots. Edges are sparse enough (0.8 per
+ * node, on average) that the live set stays bounded. */
+static void run_graph(bench *b, const workload *w, size_t allocs) {
+    size_t i = 0;
+    b->root_count = w->live;
+    for (i = 0; i < b->root_count; i++) b->roots[i] = OSCAR_ID_NONE;
+
+    while (b->allocs < allocs) {
+        pool_id id = bench_alloc(b);
+        node *n = get(b, id);
+        for (i = 0; i < MAX_EDGES; i++) {
+            if (rng_next(b) % 5 == 0) {
+                n->edge[i] = b->roots[rng_next(b) % b->root_count];
+            }
+        }
+        b->roots[rng_next(b) % b->root_count] = id;
+    }
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x < y ? -1 : x > y ? 1 : 0);
+}
+
+static double pause_us(bench *b, double pct) {
+    size_t i = 0;
+    if (b->pause_count == 0) return 0;
+    i = (size_t) (pct / 100.0 * (double) (b->pause_count - 1) + 0.5);
+    return (double) b->pauses[i] / 1000.0;
+}
+
+static void run(const workload *w, double scale, int json) {
+    bench b;
+    size_t cell_sz = sizeof(node) + w->pad;
+    size_t allocs = (size_t) ((double) w->allocs * scale);
+    char *mem = NULL;
+    struct rusage ru;
+    uint64_t t0 = 0, elapsed = 0;
+    double secs = 0;
+
+    memset(&b, 0, sizeof(b));
+    b.rng = 0x9e3779b97f4a7c15ULL;
+    b.inline_get = w->inline_get;
+    b.roots = calloc(w->shape == GRAPH ? w->live : 2, sizeof(pool_id));
+    if (b.roots == NULL) exit(1);
+    cell_sz = (cell_sz + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+
+    if (w->fixed) {
+        size_t bytes = oscar_fixed_size(cell_sz, w->fixed_count, NULL);
+        mem = malloc(bytes);
+        if (mem == NULL) exit(1);
+        b.p = oscar_new_fixed(cell_sz, bytes, mem, mark_graph, &b, NULL, NULL);
+    } else {
+        b.p = oscar_new(cell_sz, 1024, oscar_generic_mem_cb, NULL,
+            mark_graph, &b, NULL, NULL);
+    }
+    if (b.p == NULL) exit(1);
+    if (w->epoch && oscar_set_epoch_marks(b.p, 1) < 0) exit(1);
+    if (w->profile && oscar_profile_start(b.p, w->profile) < 0) exit(1);
+
+    t0 = now_ns();
+    switch (w->shape) {
+    case LIST: run_list(&b, w, allocs); break;
+    case TREE: run_tree(&b, w, allocs); break;
+    case GRAPH: run_graph(&b, w, allocs); break;
+    }
+    elapsed = now_ns() - t0;
+    secs = (double) elapsed / 1e9;
+    qsort(b.pauses, b.pause_count, sizeof(uint64_t), cmp_u64);
+    getrusage(RUSAGE_SELF, &ru);
+
+    if (json) {
+        printf("{\"workload\": \"%s\", \"pool\": \"%s\", \"cell_sz\": %lu, "
+            "\"allocs\": %lu, \"seconds\": %.3f, \"allocs_per_sec\": %.0f, "
+            "\"collections\": %lu, \"mark_ms\": %.3f, \"sweep_ms\": %.3f, "
+            "\"pause_p50_us\": %.1f, \"pause_p99_us\": %.1f, "
+            "\"pause_max_us\": %.1f, \"final_count\": %lu, "
+            "\"peak_rss_kb\": %ld}\n",
+            w->name, w->fixed ? "fixed" : "dynamic", (unsigned long) cell_sz,
+            (unsigned long) b.allocs, secs, (double) b.allocs / secs,
+            (unsigned long) b.collections, (double) b.mark_ns / 1e6,
+            (double) b.sweep_ns / 1e6, pause_us(&b, 50), pause_us(&b, 99),
+            pause_us(&b, 100), (unsigned long) oscar_count(b.p),
+            (long) ru.ru_maxrss);
+    } else {
+        printf("%s,%s,%lu,%lu,%.3f,%.0f,%lu,%.3f,%.3f,%.1f,%.1f,%.1f,%lu,%ld\n",
+            w->name, w->fixed ? "fixed" : "dynamic", (unsigned long) cell_sz,
+            (unsigned long) b.allocs, secs, (double) b.allocs / secs,
+            (unsigned long) b.collections, (double) b.mark_ns / 1e6,
+            (double) b.sweep_ns / 1e6, pause_us(&b, 50), pause_us(&b, 99),
+            pause_us(&b, 100), (unsigned long) oscar_count(b.p),
+            (long) ru.ru_maxrss);
+    }
+    fflush(stdout);
+
+    oscar_free(b.p);
+    free(mem);
+    free(b.roots);
+    free(b.stack);
+    free(b.pauses);
+    free(b.todo);
+}
+
+static void usage(void) {
+    size_t i = 0;
+    fprintf(stderr, "usage: bench_oscar [-f csv|json] [-s SCALE] [WORKLOAD...]\n"
+        "workloads:");
+    for (i = 0; i < WORKLOAD_COUNT; i++) fprintf(stderr, " %s", workloads[i].name);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int json = 0, c = 0, status = 0, failed = 0;
+    double scale = 1.0;
+    size_t i = 0;
+
+    while ((c = getopt(argc, argv, "f:s:h")) != -1) {
+        switch (c) {
+        case 'f':
+            if (strcmp(optarg, "json") == 0) {
+                json = 1;
+            } else if (strcmp(optarg, "csv") != 0) {
+                usage();
+            }
+            break;
+        case 's':
+            scale = atof(optarg);
+            if (scale <= 0) usage();
+            break;
+        default:
+            usage();
+        }
+    }
+
+    for (c = optind; c < argc; c++) {
+        for (i = 0; i < WORKLOAD_COUNT; i++) {
+            if (strcmp(argv[c], workloads[i].name) == 0) break;
+        }
+        if (i == WORKLOAD_COUNT) usage();
+    }
+
+    if (!json) {
+        printf("workload,pool,cell_sz,allocs,seconds,allocs_per_sec,"
+            "collections,mark_ms,sweep_ms,pause_p50_us,pause_p99_us,"
+            "pause_max_us,final_count,peak_rss_kb\n");
+        fflush(stdout);
+    }
+
+    for (i = 0; i < WORKLOAD_COUNT; i++) {
+        pid_t pid = 0;
+        if (optind < argc) {
+            for (c = optind; c < argc; c++) {
+                if (strcmp(argv[c], workloads[i].name) == 0) break;
+            }
+            if (c == argc) continue;
+        }
+
+        /* Run each workload in a child, so its peak RSS is its own. */
+        pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        } else if (pid == 0) {
+            run(&workloads[i], scale, json);
+            _exit(0);
+        }
+        if (waitpid(pid, &status, 0) < 0
+            || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "workload %s failed\n", workloads[i].name);
+            failed = 1;
+        }
+    }
+    return failed;
+}
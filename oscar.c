@@ -4,30 +4,70 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <strings.h>
 #include <assert.h>
 
 #include "oscar.h"
+#include "oscar_inline.h"
+#include "oscar_internal.h"
+#include "oscar_profile.h"
+#include "oscar_trace.h"
+#include "oscar_concurrent.h"
 
 /* Note: this uses __VA_ARGS__ (from C99), but the rest only
  * depends on C89. LOG(...) could be safely removed. */
 #define DEBUG 0
 #define LOG(...) { if (DEBUG) fprintf(stderr, __VA_ARGS__); }
 
-struct oscar {
-    unsigned int cell_sz;       /* each cell is CELL_SZ bytes */
-    unsigned int count;         /* number of cells */
-    unsigned int marked;        /* how many were marked */
-    unsigned int sz;            /* size of RAW, in bytes */
-    pool_id sweep;              /* lazy sweep index */
-    oscar_memory_cb *mem_cb;    /* memory callback */
-    void *mem_udata;            /* userdata for ^ */
-    oscar_mark_cb *mark_cb;     /* marking callback */
-    void *mark_udata;           /* userdata for ^ */
-    oscar_free_cb *free_cb;     /* free callback */
-    void *free_udata;           /* userdata for ^ */
-    char *raw;                  /* raw memory for storage, COUNT cells */
-    char *markbits;             /* mark bit array, at end of RAW */
-};
+/* Largest cell count for which every ID is below OSCAR_ID_NONE.
+ * (If pool_id is wider than size_t, this is just SIZE_MAX.) */
+#define MAX_COUNT ((size_t) OSCAR_ID_NONE)
+
+/* Round N up to a multiple of ALIGN, a power of two. */
+#define ALIGN_UP(N, ALIGN) (((N) + (ALIGN) - 1) & ~((size_t) (ALIGN) - 1))
+
+/* Bits in one mark bitmap word. */
+#define WORD_BITS 64
+
+/* Memory callbacks are only assumed to return pointer-aligned memory. */
+#define MIN_ALIGN sizeof(void *)
+
+/* Count trailing zeroes in a non-zero word. */
+static unsigned int ctz64(uint64_t w) {
+#if defined(__GNUC__)
+    return (unsigned int) __builtin_ctzll(w);
+#else
+    unsigned int n = 0;
+    while ((w & 1) == 0) { w >>= 1; n++; }
+    return n;
+#endif
+}
+
+/* Test the ID'th bit in BITS. */
+#define BIT_TEST(BITS, ID) \
+    ((BITS)[(ID) / WORD_BITS] & (((uint64_t) 1) << ((ID) % WORD_BITS)))
+
+/* Get word W of POOL's marks, or test whether cell ID is marked,
+ * taking the sense of epoch marks into account. */
+#define MARK_WORD(POOL, W) ((POOL)->markbits[W] ^ (POOL)->mark_flip)
+#define MARK_TEST(POOL, ID) \
+    (MARK_WORD(POOL, (ID) / WORD_BITS) & (((uint64_t) 1) << ((ID) % WORD_BITS)))
+
+/* Set (if ON) or clear bits FROM up to (but not including) TO. */
+static void set_bit_range(uint64_t *bits, size_t from, size_t to, int on) {
+    while (from < to) {
+        size_t w = from / WORD_BITS, bit = from % WORD_BITS;
+        size_t n = (to - from < WORD_BITS - bit ? to - from : WORD_BITS - bit);
+        uint64_t mask = (n == WORD_BITS ? ~(uint64_t) 0
+            : ((((uint64_t) 1) << n) - 1) << bit);
+        if (on) {
+            bits[w] |= mask;
+        } else {
+            bits[w] &= ~mask;
+        }
+        from += n;
+    }
+}
 
 /* An oscar_memory_cb that just calls malloc/free/realloc. */
 void *oscar_generic_mem_cb(void *p, size_t old_sz,
@@ -37,17 +77,98 @@ void *oscar_generic_mem_cb(void *p, size_t old_sz,
     return realloc(p, new_sz);
 }
 
-static oscar *new_pool(unsigned int cell_sz, unsigned int count,
-                       oscar *p, unsigned int raw_sz, char *raw,
-                       oscar_memory_cb *mem_cb, void *mem_udata,
-                       oscar_mark_cb *mark_cb, void *mark_udata,
-                       oscar_free_cb *free_cb, void *free_udata) {
-    if (p == NULL || raw == NULL) return NULL;
+/* Get the size of the mark bitmap for COUNT cells, in bytes. It's padded
+ * to a whole number of cache lines, so it never shares one with cells. */
+static size_t mark_bytes(size_t count) {
+    size_t words = count / WORD_BITS + 1;
+    return ALIGN_UP(words * sizeof(uint64_t), OSCAR_CACHE_LINE);
+}
+
+/* Get how many extra bytes to allocate so an ALIGN-aligned region
+ * can be carved out of memory from a memory callback. */
+static size_t align_slack(size_t align) {
+    return (align > MIN_ALIGN ? align - 1 : 0);
+}
+
+/* Resize one of the pool's regions (the cells or a side table) from
+ * OLD_BYTES to NEW_BYTES, keeping it ALIGN-aligned. *BASE and *BASE_SZ
+ * track the underlying allocation, which is NULL to start. The first
+ * OLD_BYTES are preserved and the rest are zeroed. Returns the aligned
+ * region, or NULL (leaving the old allocation intact) on failure. */
+static void *resize_region_cb(oscar_memory_cb *cb, void *udata,
+                              char **base, size_t *base_sz,
+                              size_t old_bytes, size_t new_bytes,
+                              size_t align) {
+    size_t old_offset = 0, new_offset = 0;
+    size_t sz = new_bytes + align_slack(align);
+    char *nbase = NULL;
+    if (sz < new_bytes) return NULL; /* overflow */
+
+    if (*base) {
+        old_offset = ALIGN_UP((uintptr_t) *base, align) - (uintptr_t) *base;
+    }
+    nbase = cb(*base, *base_sz, sz, udata);
+    if (nbase == NULL) return NULL;
 
-    bzero(raw, raw_sz);
+    /* If realloc moved the allocation to a differently aligned address,
+     * the contents need to shift to the new aligned start. */
+    new_offset = ALIGN_UP((uintptr_t) nbase, align) - (uintptr_t) nbase;
+    if (old_bytes > 0 && new_offset != old_offset) {
+        memmove(nbase + new_offset, nbase + old_offset, old_bytes);
+    }
+    bzero(nbase + new_offset + old_bytes, new_bytes - old_bytes);
+    *base = nbase;
+    *base_sz = sz;
+    return nbase + new_offset;
+}
+
+/* Resize a region using the pool's own memory callback. */
+static void *resize_region(oscar *p, char **base, size_t *base_sz,
+                           size_t old_bytes, size_t new_bytes, size_t align) {
+    return resize_region_cb(p->mem_cb, p->mem_udata, base, base_sz,
+        old_bytes, new_bytes, align);
+}
+
+/* Resize one of the optional per-cell bitmaps (span or escape bits),
+ * from the pool's current count to COUNT cells. Allocates it if *BITS
+ * is NULL and ALLOC is set; otherwise a missing bitmap is left alone. */
+static int resize_bitmap(oscar *p, uint64_t **bits, char **base,
+                         size_t *sz, size_t count, int alloc) {
+    uint64_t *nbits = NULL;
+    if (*bits == NULL && !alloc) return 0;
+    nbits = (uint64_t *) resize_region(p, base, sz,
+        (*bits ? mark_bytes(p->count) : 0), mark_bytes(count),
+        OSCAR_CACHE_LINE);
+    if (nbits == NULL) return -1;
+    *bits = nbits;
+    return 0;
+}
+
+/* Grow whichever optional bitmaps POOL has to cover COUNT cells. */
+static int grow_side_bitmaps(oscar *p, size_t count) {
+    if (resize_bitmap(p, &p->spanbits, &p->spanbits_base,
+            &p->spanbits_sz, count, 0) < 0) {
+        return -1;
+    }
+    return resize_bitmap(p, &p->escapebits, &p->escapebits_base,
+        &p->escapebits_sz, count, 0);
+}
+
+/* Make cells FROM up to TO look unmarked, such as new ones. */
+static void unmark_range(oscar *p, size_t from, size_t to) {
+    set_bit_range(p->markbits, from, to, p->mark_flip != 0);
+}
+
+static void init_pool(oscar *p, size_t cell_sz, size_t cell_align,
+                      size_t count,
+                      oscar_memory_cb *mem_cb, void *mem_udata,
+                      oscar_mark_cb *mark_cb, void *mark_udata,
+                      oscar_free_cb *free_cb, void *free_udata) {
+    bzero(p, sizeof(*p));
     p->cell_sz = cell_sz;
-    p->sz = raw_sz;
+    p->cell_align = cell_align;
     p->count = count;
+    p->max_count = MAX_COUNT;
     p->marked = 0;
     p->sweep = 0;
     p->mem_cb = mem_cb;
@@ -56,247 +177,1191 @@ static oscar *new_pool(unsigned int cell_sz, unsigned int count,
     p->mark_udata = mark_udata;
     p->free_cb = free_cb;
     p->free_udata = free_udata;
-    p->raw = raw;
-    p->markbits = raw + (cell_sz * count);
-
-    if (1) {                    /* ensure regions don't overlap */
-        int i = 0;
-        char *p_end = (char *) p + sizeof(*p);
-        char *raw_end = raw + (cell_sz * count);
-        char *markbits_end = p->markbits + (count / 8) + 1;
-        LOG("p: %p p_end: %p\n", (void *) p, p_end);
-        LOG("raw: %p raw_end: %p\n", raw, raw_end);
-        for (i=0; i<count; i++) {
-            char *cell = (char *) oscar_get(p, i);
-            LOG("cell[%d] = %p ~ %p\n", i, cell, cell + cell_sz - 1);
-        }
-        LOG("markbits: %p markbits_end: %p\n", p->markbits, markbits_end);
-        assert(p_end <= raw || (char *) p > markbits_end);
-        assert(raw_end <= p->markbits);
-        
+    p->raw_count = count;
+}
+
+/* Lay out a fixed pool of COUNT cells at MEMORY:
+ * ['oscar' data structure, sizeof(oscar) bytes, 150 or so]
+ * [padding to a cache line][mark bits, in whole cache lines]
+ * [padding to pointer alignment][CELL_SZ * COUNT bytes]
+ * Set *MARKBITS_OFFSET and *RAW_OFFSET, and return the total size,
+ * or 0 on overflow. If MEMORY is NULL, assume the worst-case padding. */
+static size_t fixed_layout(const char *memory, size_t cell_sz, size_t count,
+                           size_t *markbits_offset, size_t *raw_offset) {
+    uintptr_t base = (uintptr_t) memory;
+    size_t mark_off = 0, raw_off = 0;
+    if (memory == NULL) {
+        mark_off = sizeof(oscar) + OSCAR_CACHE_LINE - 1;
+        raw_off = mark_off + mark_bytes(count) + MIN_ALIGN - 1;
+    } else {
+        mark_off = ALIGN_UP(base + sizeof(oscar), OSCAR_CACHE_LINE) - base;
+        raw_off = ALIGN_UP(base + mark_off + mark_bytes(count), MIN_ALIGN)
+            - base;
     }
-    return p;
+    if (markbits_offset) *markbits_offset = mark_off;
+    if (raw_offset) *raw_offset = raw_off;
+    if (count > (SIZE_MAX - raw_off) / cell_sz) return 0;
+    return raw_off + count * cell_sz;
+}
+
+size_t oscar_fixed_size(size_t cell_sz, size_t count, const char *memory) {
+    if (cell_sz == 0) return 0;
+    return fixed_layout(memory, cell_sz, count, NULL, NULL);
 }
 
 /* Init a fixed-sized garbage-collected pool of as many CELL_SZ-byte cells as will
  * fit inside the BYTES bytes pointed to by MEMORY.
  * For the various callbacks, see their typedefs.
  * Return NULL on error, such as if the provided memory in insufficient. */
-oscar *oscar_new_fixed(unsigned int cell_sz, unsigned int bytes, char *memory,
-                      oscar_mark_cb *mark_cb, void *mark_udata,
+oscar *oscar_new_fixed(size_t cell_sz, size_t bytes, char *memory,
+                       oscar_mark_cb *mark_cb, void *mark_udata,
                        oscar_free_cb *free_cb, void *free_udata) {
-    /* The internal memory is laid out like so:
-     * ['oscar' data structure, sizeof(oscar) bytes, 88 or so]
-     * [CELL_SZ * COUNT bytes][COUNT/8 bytes of mark bits, rounded up] */
-    unsigned int rem = 0, count = 0;
+    size_t count = 0, sz = 0, avail = 0, mark_off = 0, raw_off = 0;
+    oscar *p = (oscar *) memory;
 
 #define FAIL(msg) { fprintf(stderr, msg "\n"); return NULL; }
     if (cell_sz < sizeof(pool_id)) FAIL("cell_sz is too small");
     if ((cell_sz % sizeof(void *)) != 0)
         FAIL("cell_sz must be a multiple of sizeof(void *) due to alignment");
     if (memory == NULL) FAIL("NULL memory pool");
-    /* There needs to be room for at _least_ 1 cell and 1 mark bit
-     * (though a one-cell GC pool is pretty useless...). */
-    rem = bytes - sizeof(oscar);
-    if (bytes < sizeof(oscar) || rem < 2*cell_sz)
-        FAIL("memory pool is too small for GC");
     if (mark_cb == NULL) FAIL("NULL mark_cb");
+    /* There needs to be room for at _least_ 1 cell
+     * (though a one-cell GC pool is pretty useless...). */
+    sz = fixed_layout(memory, cell_sz, 1, NULL, NULL);
+    if (sz == 0 || sz > bytes) FAIL("memory pool is too small for GC");
 #undef FAIL
 
-    count = rem / cell_sz;
-    /* Reduce count as necessary to fit mark bits at the end. */
-    while (count * cell_sz + (count / 8 + 1) > rem) count--;
+    /* Estimate how many more cells fit, at CELL_SZ bytes + 1 mark bit
+     * each, then reduce count as necessary to fit the padded mark bits. */
+    avail = bytes - sz;
+    count = 1 + 8 * (avail / (8 * cell_sz + 1)) +
+        (8 * (avail % (8 * cell_sz + 1))) / (8 * cell_sz + 1);
+    if (count > MAX_COUNT) count = MAX_COUNT;
+    for (;;) {
+        sz = fixed_layout(memory, cell_sz, count, &mark_off, &raw_off);
+        if (sz != 0 && sz <= bytes) break;
+        count--;
+    }
 
-    return new_pool(cell_sz, count, (oscar *) memory,
-        rem, memory + sizeof(oscar),
+    init_pool(p, cell_sz, MIN_ALIGN, count,
         NULL /* no memory cb -> don't malloc/reallocate/free */, NULL,
         mark_cb, mark_udata, free_cb, free_udata);
+    p->markbits = (uint64_t *) (memory + mark_off);
+    p->markbits_sz = mark_bytes(count);
+    p->raw = memory + raw_off;
+    p->sz = count * cell_sz;
+    bzero(p->markbits, p->markbits_sz);
+    bzero(p->raw, p->sz);
+
+    /* ensure regions don't overlap */
+    assert((char *) p + sizeof(*p) <= (char *) p->markbits);
+    assert((char *) p->markbits + p->markbits_sz <= p->raw);
+    assert(p->raw + p->sz <= memory + bytes);
+    return p;
 }
 
 /* Init a garbage-collected pool of START_COUNT cells, each CELL_SZ bytes.
  * For the various callbacks, see their typedefs.
  * Returns NULL on error (allocation failure or NULL callbacks). */
-oscar *oscar_new(unsigned int cell_sz, unsigned int start_count,
+oscar *oscar_new(size_t cell_sz, size_t start_count,
                  oscar_memory_cb *mem_cb, void *mem_udata,
                  oscar_mark_cb *mark_cb, void *mark_udata,
                  oscar_free_cb *free_cb, void *free_udata) {
-    oscar *p = NULL;
-    char *raw = NULL;
-    unsigned int raw_sz = cell_sz * start_count + (cell_sz / 8) + 1;
-#define FAIL(msg) { fprintf(stderr, msg "\n"); return NULL; }
-    if (cell_sz < sizeof(pool_id)) FAIL("cell_sz is too small");
-    if ((cell_sz % sizeof(void *)) != 0)
+    return oscar_new_aligned(cell_sz, MIN_ALIGN, start_count,
+        mem_cb, mem_udata, mark_cb, mark_udata, free_cb, free_udata);
+}
+
+/* Check the arguments for a dynamic pool, rounding *CELL_SZ up to
+ * CELL_ALIGN. Returns <0 on error. */
+static int check_dynamic_args(size_t *cell_sz, size_t cell_align,
+                              size_t count, oscar_memory_cb *mem_cb,
+                              oscar_mark_cb *mark_cb) {
+#define FAIL(msg) { fprintf(stderr, msg "\n"); return -1; }
+    if (*cell_sz < sizeof(pool_id)) FAIL("cell_sz is too small");
+    if ((*cell_sz % sizeof(void *)) != 0)
         FAIL("cell_sz must be a multiple of sizeof(void *) due to alignment");
-    if (start_count < 1) FAIL("bad count");
+    if (cell_align < MIN_ALIGN || (cell_align & (cell_align - 1)) != 0)
+        FAIL("cell_align must be a power of 2, at least sizeof(void *)");
+    if (*cell_sz > SIZE_MAX - cell_align) FAIL("cell_sz is too large");
+    *cell_sz = ALIGN_UP(*cell_sz, cell_align);
+    if (count < 1) FAIL("bad count");
+    if (count > MAX_COUNT) FAIL("count is too large for pool_id");
+    if (count > (SIZE_MAX - align_slack(cell_align)) / *cell_sz)
+        FAIL("pool size overflows size_t");
     if (mark_cb == NULL) FAIL("NULL mark_cb");
     if (mem_cb == NULL) FAIL("NULL mem_cb");
 #undef FAIL
+    return 0;
+}
 
-    p = mem_cb(NULL, 0, sizeof(*p), mem_udata);
-    if (p == NULL) goto cleanup;
+/* Init a dynamic pool. If RAW is non-NULL, it is an allocation of RAW_SZ
+ * bytes (as far as mem_cb is concerned) already holding the cells;
+ * otherwise, zeroed cells are allocated. */
+static oscar *new_dynamic(size_t cell_sz, size_t cell_align, size_t count,
+                          char *raw, size_t raw_sz,
+                          oscar_memory_cb *mem_cb, void *mem_udata,
+                          oscar_mark_cb *mark_cb, void *mark_udata,
+                          oscar_free_cb *free_cb, void *free_udata) {
+    oscar *p = mem_cb(NULL, 0, sizeof(*p), mem_udata);
+    if (p == NULL) return NULL;
+    init_pool(p, cell_sz, cell_align, count,
+        mem_cb, mem_udata, mark_cb, mark_udata, free_cb, free_udata);
 
-    raw = mem_cb(NULL, 0, raw_sz, mem_udata);
-    if (raw == NULL) goto cleanup;
+    if (raw) {
+        p->raw = p->raw_base = raw;
+        p->sz = raw_sz;
+    } else {
+        p->raw = resize_region(p, &p->raw_base, &p->sz,
+            0, cell_sz * count, cell_align);
+        if (p->raw == NULL) goto cleanup;
+    }
 
-    return new_pool(cell_sz, start_count, p,
-        raw_sz, raw, mem_cb, mem_udata,
-        mark_cb, mark_udata, free_cb, free_udata);
+    p->markbits = (uint64_t *) resize_region(p, &p->markbits_base,
+        &p->markbits_sz, 0, mark_bytes(count), OSCAR_CACHE_LINE);
+    if (p->markbits == NULL) goto cleanup;
+    return p;
 
 cleanup:
-    if (p) mem_cb(p, sizeof(*p), 0, mem_udata);
-    if (raw) mem_cb(raw, raw_sz, 0, mem_udata);
+    if (p->raw_base && raw == NULL) mem_cb(p->raw_base, p->sz, 0, mem_udata);
+    mem_cb(p, sizeof(*p), 0, mem_udata);
     return NULL;
 }
 
-unsigned int oscar_count(oscar *pool) { return pool->count; }
+/* Init a garbage-collected pool of START_COUNT cells, each CELL_SZ bytes
+ * and starting on a CELL_ALIGN-byte boundary. */
+oscar *oscar_new_aligned(size_t cell_sz, size_t cell_align,
+                         size_t start_count,
+                         oscar_memory_cb *mem_cb, void *mem_udata,
+                         oscar_mark_cb *mark_cb, void *mark_udata,
+                         oscar_free_cb *free_cb, void *free_udata) {
+    if (check_dynamic_args(&cell_sz, cell_align, start_count,
+            mem_cb, mark_cb) < 0) {
+        return NULL;
+    }
+    return new_dynamic(cell_sz, cell_align, start_count, NULL, 0,
+        mem_cb, mem_udata, mark_cb, mark_udata, free_cb, free_udata);
+}
+
+/* Init a dynamic pool around COUNT existing cells at RAW. */
+oscar *oscar_new_with_cells(size_t cell_sz, size_t cell_align, size_t count,
+                            char *raw, size_t raw_sz,
+                            oscar_memory_cb *mem_cb, void *mem_udata,
+                            oscar_mark_cb *mark_cb, void *mark_udata,
+                            oscar_free_cb *free_cb, void *free_udata) {
+    size_t sz = cell_sz;
+    if (check_dynamic_args(&sz, cell_align, count, mem_cb, mark_cb) < 0) {
+        return NULL;
+    }
+    if (sz != cell_sz || raw == NULL || ((uintptr_t) raw % cell_align) != 0
+        || raw_sz < cell_sz * count) {
+        fprintf(stderr, "bad cells for pool\n");
+        return NULL;
+    }
+    return new_dynamic(cell_sz, cell_align, count, raw, raw_sz,
+        mem_cb, mem_udata, mark_cb, mark_udata, free_cb, free_udata);
+}
+
+/* Move POOL onto COUNT cells at RAW, growing the mark bits to match. */
+int oscar_set_cells(oscar *pool, char *raw, size_t raw_sz, size_t count) {
+    uint64_t *markbits = NULL;
+    if (count < pool->count || count > pool->max_count
+        || ((uintptr_t) raw % pool->cell_align) != 0
+        || count > raw_sz / pool->cell_sz) {
+        return -1;
+    }
+    if (count > pool->count) {
+        markbits = (uint64_t *) resize_region(pool, &pool->markbits_base,
+            &pool->markbits_sz, mark_bytes(pool->count), mark_bytes(count),
+            OSCAR_CACHE_LINE);
+        if (markbits == NULL) return -1;
+        pool->markbits = markbits;
+        unmark_range(pool, pool->count, count);
+        if (grow_side_bitmaps(pool, count) < 0) return -1;
+    }
+    pool->raw = pool->raw_base = raw;
+    pool->sz = raw_sz;
+    pool->count = pool->raw_count = count;
+    return 0;
+}
+
+size_t oscar_count(oscar *pool) { return pool->count; }
+
+void oscar_get_stats(oscar *pool, oscar_stats *stats) {
+    stats->count = pool->count;
+    stats->cell_sz = pool->cell_sz;
+    stats->marked = pool->marked;
+    stats->bytes = (pool->mem_cb
+        ? pool->sz + pool->markbits_sz + pool->spanbits_sz
+            + pool->escapebits_sz
+        : (size_t) (pool->raw + pool->sz - (char *) pool)
+            + pool->overflow_sz
+            + (pool->markbits_base ? pool->markbits_sz : 0));
+    stats->huge_bytes = pool->huge_bytes;
+    stats->collections = pool->cycles;
+}
+
+/* Limit a dynamic pool to at most MAX_COUNT cells. Returns <0 if the
+ * pool already has more cells than that. */
+int oscar_set_max_count(oscar *pool, size_t max_count) {
+    if (pool->count > max_count) return -1;
+    if (max_count > MAX_COUNT) max_count = MAX_COUNT;
+    pool->max_count = max_count;
+    return 0;
+}
+
+/* Let a fixed pool spill into up to MAX_CELLS overflow cells. */
+int oscar_set_overflow(oscar *pool, size_t max_cells,
+                       oscar_memory_cb *mem_cb, void *mem_udata) {
+    if (pool->mem_cb != NULL || pool->overflow != NULL
+        || (max_cells > 0 && mem_cb == NULL)) {
+        return -1;
+    }
+    pool->overflow_max = max_cells;
+    pool->overflow_cb = mem_cb;
+    pool->overflow_udata = mem_udata;
+    return 0;
+}
+
+void oscar_set_watermark(oscar *pool, size_t watermark,
+                         oscar_watermark_cb *cb, void *udata) {
+    pool->watermark = watermark;
+    pool->watermark_cb = cb;
+    pool->watermark_udata = udata;
+    pool->flags &= ~OSCAR_FLAG_ABOVE_WATERMARK;
+}
+
+/* Switch between plain mark bits and epoch marks. Either way, cells
+ * the lazy sweep has yet to pass keep their marks; the ones it has
+ * passed are reset the way the new mode expects. */
+int oscar_set_epoch_marks(oscar *pool, int on) {
+    int was = ((pool->flags & OSCAR_FLAG_EPOCH_MARKS) != 0);
+    size_t w = 0, words = (pool->count + WORD_BITS - 1) / WORD_BITS;
+    if (pool->concurrent || (pool->flags & OSCAR_FLAG_READER)) return -1;
+    if (on && !was) {
+        set_bit_range(pool->markbits, 0, pool->sweep, 1);
+        pool->flags |= OSCAR_FLAG_EPOCH_MARKS;
+    } else if (!on && was) {
+        if (pool->mark_flip) {
+            for (w = 0; w < words; w++) pool->markbits[w] = ~pool->markbits[w];
+            pool->mark_flip = 0;
+        }
+        set_bit_range(pool->markbits, 0, pool->sweep, 0);
+        set_bit_range(pool->markbits, pool->count, words * WORD_BITS, 0);
+        pool->flags &= ~OSCAR_FLAG_EPOCH_MARKS;
+    }
+    return 0;
+}
 
 /* Mark the ID'th cell as reachable.
  * TODO If this were changed to return a new pool_id, would
  * that be sufficient to permit generational GC? The user's
  * mark_cb could update references while marking. */
 void oscar_mark(oscar *pool, pool_id id) {
-    unsigned int byte = id / 8;
-    char bit = 1 << (id % 8);
-    if (id >= pool->count || pool->markbits[byte] & bit) return;
-    LOG(" -- marking ID %u\n", id);
-    pool->markbits[byte] |= bit;
-    pool->marked++;
+    if (pool->concurrent) {
+        (void) oscar_concurrent_mark(pool, id);
+    } else if (oscar_mark_inline(pool, id)) {
+        LOG(" -- marking ID %lu\n", (unsigned long) id);
+    }
+}
+
+/* Get a pointer to the ID'th cell, which may be past RAW_COUNT in a
+ * fixed pool's overflow. */
+static void *cell_ptr(oscar *pool, pool_id id) {
+    if (id >= pool->raw_count) {
+        return pool->overflow + ((id - pool->raw_count) * pool->cell_sz);
+    }
+    return pool->raw + (id * pool->cell_sz);
 }
 
 /* Get a pointer to a cell, by ID. Returns NULL on error. */
 void *oscar_get(oscar *pool, pool_id id) {
-    void *p = NULL;
-    if (id < pool->count) p = pool->raw + (id * pool->cell_sz);
-    return p;
+    return (id < pool->count ? cell_ptr(pool, id) : NULL);
+}
+
+/* Get how many cells the span starting at ID covers: the cell itself,
+ * plus any following cells flagged in SPANBITS as continuing it. */
+static size_t span_cells(oscar *pool, pool_id id) {
+    size_t i = (size_t) id + 1;
+    if (pool->spanbits == NULL) return 1;
+    while (i < pool->count) {
+        uint64_t heads = ~pool->spanbits[i / WORD_BITS] >> (i % WORD_BITS);
+        if (heads != 0) {
+            i += ctz64(heads);
+            break;
+        }
+        i += WORD_BITS - i % WORD_BITS;
+    }
+    if (i > pool->count) i = pool->count;
+    return i - id;
 }
 
-static int check_and_clear_mark(char *markbits, pool_id id) {
-    unsigned int byte_id = id / 8;
-    unsigned int byte = markbits[byte_id];
-    char bit = 1 << (id % 8);
-    markbits[byte_id] &= ~bit;
-    LOG("id %d -> byte %d, bit %d -> %d\n", id, byte, bit, byte & bit);
-    return byte & bit;
+/* Sweep the unmarked cell ID: call free_cb on it and zero it. If it
+ * starts a span, the rest of the span is zeroed and freed along with it,
+ * without further free_cb calls. */
+static void sweep_cell(oscar *pool, pool_id id) {
+    size_t cells = span_cells(pool, id);
+    if (pool->free_cb) pool->free_cb(pool, id, pool->free_udata);
+    LOG("-- sweeping unmarked cell, %lu\n", (unsigned long) id);
+    if (cells > 1) {
+        set_bit_range(pool->spanbits, (size_t) id + 1, id + cells, 0);
+    }
+    bzero(cell_ptr(pool, id), cells * pool->cell_sz);
+}
+
+void oscar_sweep_cell(oscar *pool, pool_id id) { sweep_cell(pool, id); }
+
+size_t oscar_span_length(oscar *pool, pool_id id) {
+    if (id >= pool->count) return 0;
+    if (pool->spanbits && BIT_TEST(pool->spanbits, id)) return 0;
+    return span_cells(pool, id);
+}
+
+/* Reset the mark bits of the cells in PASSED, which the lazy sweep has
+ * just passed over (or handed out) in word W, whose marks are MARKS.
+ * Normally they're cleared for the next collection. With epoch marks,
+ * they are all made to look marked instead, so the next collection can
+ * unmark them at once by flipping the sense. The live ones already do,
+ * so a word of live cells is only read, never written. */
+static void pass_word(oscar *pool, size_t w, uint64_t passed,
+                      uint64_t marks) {
+    if (pool->flags & OSCAR_FLAG_EPOCH_MARKS) {
+        uint64_t unmarked = passed & ~marks;
+        if (unmarked != 0) pool->markbits[w] ^= unmarked;
+    } else {
+        pool->markbits[w] &= ~passed;
+    }
 }
 
+/* Lazily sweep from START, resetting the mark bits of live cells along
+ * the way, and return the first unmarked cell. Words of all-live cells
+ * are skipped whole. Cells continuing a span are never returned: they
+ * are live if the span's first cell is, and are freed with it if not. */
 static pool_id find_unmarked(oscar *pool, pool_id start) {
-    pool_id id = 0;
-    for (id = start; id < pool->count; id++) {
-        LOG(" -- find_unmarked, %d / %d\n", id, pool->count);
-
-        /* TODO available mark bits could be checked and swept a byte
-         * or more at a time, amortizing the cost of the bit ops. */
-        if (!check_and_clear_mark(pool->markbits, id)) {
-            char *p = pool->raw + (pool->cell_sz * id);
-            if (pool->free_cb) pool->free_cb(pool, id, pool->free_udata);
-            LOG("-- sweeping & returning unmarked cell, %d\n", id);
-            bzero(p, pool->cell_sz);
-            pool->sweep = id + 1;
-            return id;
+    size_t w = start / WORD_BITS;
+    size_t words = (pool->count + WORD_BITS - 1) / WORD_BITS;
+    /* Bits below START in the first word are treated as live. */
+    uint64_t below = (((uint64_t) 1) << (start % WORD_BITS)) - 1;
+
+    for (; w < words; w++, below = 0) {
+        uint64_t span = (pool->spanbits ? pool->spanbits[w] : 0);
+        uint64_t marks = MARK_WORD(pool, w);
+        uint64_t free_bits = ~(marks | below | span);
+        unsigned int bit = 0;
+        pool_id id = 0;
+        LOG(" -- find_unmarked, word %lu / %lu\n",
+            (unsigned long) w, (unsigned long) words);
+        if (free_bits == 0) {
+            pass_word(pool, w, ~below, marks); /* the whole word at once */
+            continue;
         }
+
+        bit = ctz64(free_bits);
+        id = (pool_id) (w * WORD_BITS + bit);
+        if (id >= pool->count) {
+            pass_word(pool, w, ~below & ((((uint64_t) 1) << bit) - 1), marks);
+            break;
+        }
+        /* Reset the cells passed over, from START up to and including
+         * BIT, the one handed out. */
+        pass_word(pool, w, ~below & (~(uint64_t) 0 >> (WORD_BITS - 1 - bit)),
+            marks);
+        if (id >= pool->preswept) sweep_cell(pool, id);
+        pool->sweep = id + 1;
+        if (pool->profile) oscar_profile_allocated(pool, id);
+        if (pool->trace) oscar_trace_allocated(pool, id, 1);
+        return id;
     }
+    pool->sweep = pool->count;
     return OSCAR_ID_NONE;
 }
 
-/* Grow the GC pool, zeroing the new memory and moving the old mark bits. */
+/* Grow the GC pool, zeroing the new cells and mark bits. */
 static int grow_pool(oscar *p) {
-    unsigned int cell_sz = p->cell_sz;
-    unsigned int new_sz = 2 * p->sz;
-    unsigned int old_ct = p->count;
-    char *old_raw = p->raw;
-    unsigned int old_markbits_offset = p->markbits - old_raw;
-    unsigned int count = 0, old_mark_bytes = 0;
-
-    /* If successful, realloc will copy the old mark bits, but
-     * won't move them to the intended new p->markbits. */
-    char *new_raw = p->mem_cb(old_raw, p->sz, new_sz, p->mem_udata);
-    if (new_raw == NULL) return -1; /* alloc fail */
-    
-    count = new_sz / cell_sz;
-    while (count * cell_sz + (count / 8 + 1) > new_sz) count--;
-    old_mark_bytes = (old_ct /8) + 1;
-    p->markbits = new_raw + (cell_sz * count);
-
-    /* Copy and clear the old mark bits. (They're cleared because otherwise
-     * they would show up in the middle of an otherwise un-allocated cell.) */
-    memcpy(p->markbits, new_raw + old_markbits_offset, old_mark_bytes);
-    bzero(new_raw + old_markbits_offset,
-        p->markbits - (new_raw + old_markbits_offset));
-    /* Also zero the added mark bits. */
-    bzero(p->markbits + old_mark_bytes, (count/8 + 1) - old_mark_bytes);
-
-    p->sz = new_sz;
-    p->raw = new_raw;
+    size_t old_ct = p->count;
+    size_t count = 0, limit = 0;
+    uint64_t *markbits = NULL;
+    char *raw = NULL;
+
+    if (old_ct >= p->max_count) return -1; /* out of IDs */
+    count = (old_ct > p->max_count / 2 ? p->max_count : 2 * old_ct);
+    limit = (SIZE_MAX - align_slack(p->cell_align)) / p->cell_sz;
+    if (count > limit) count = limit;
+    if (p->grow_step > 0 && count <= (SIZE_MAX - p->grow_step) / p->cell_sz) {
+        /* Fill out the last step, such as a huge page. */
+        size_t bytes = count * p->cell_sz + p->grow_step - 1;
+        count = (bytes - bytes % p->grow_step) / p->cell_sz;
+        if (count > limit) count = limit;
+        if (count > p->max_count) count = p->max_count;
+    }
+    if (count <= old_ct) return -1;
+
+    markbits = (uint64_t *) resize_region(p, &p->markbits_base,
+        &p->markbits_sz, mark_bytes(old_ct), mark_bytes(count),
+        OSCAR_CACHE_LINE);
+    if (markbits == NULL) return -1; /* alloc fail */
+    p->markbits = markbits;
+    unmark_range(p, old_ct, count);
+    if (grow_side_bitmaps(p, count) < 0) return -1;
+
+    /* If this fails, the larger bitmaps are harmless. */
+    raw = resize_region(p, &p->raw_base, &p->sz,
+        old_ct * p->cell_sz, count * p->cell_sz, p->cell_align);
+    if (raw == NULL) return -1; /* alloc fail */
+    p->raw = raw;
+    p->count = p->raw_count = count;
+    return 0;
+}
+
+/* Resize a fixed pool's overflow to OV cells, freeing it if OV is 0.
+ * The mark bits move out to the overflow's memory callback on the first
+ * spill, and back into the pool's own memory when it empties. Cells
+ * past the new end must already be swept. Returns <0 on error. */
+static int resize_overflow(oscar *p, size_t ov) {
+    size_t primary = p->raw_count, count = primary + ov;
+    size_t keep = (count < p->count ? count : p->count);
+    uint64_t *markbits = NULL;
+    char *cells = NULL;
+
+    if (ov == 0) {
+        if (p->markbits_base) {
+            size_t mark_off = 0;
+            (void) fixed_layout((char *) p, p->cell_sz, primary,
+                &mark_off, NULL);
+            markbits = (uint64_t *) ((char *) p + mark_off);
+            memcpy(markbits, p->markbits, mark_bytes(primary));
+            p->overflow_cb(p->markbits_base, p->markbits_sz, 0,
+                p->overflow_udata);
+            p->markbits_base = NULL;
+            p->markbits = markbits;
+            p->markbits_sz = mark_bytes(primary);
+        }
+        if (p->overflow) {
+            p->overflow_cb(p->overflow, p->overflow_sz, 0, p->overflow_udata);
+        }
+        p->overflow = NULL;
+        p->overflow_sz = 0;
+        p->count = primary;
+        return 0;
+    }
+
+    if (p->markbits_base == NULL) {
+        markbits = (uint64_t *) resize_region_cb(p->overflow_cb,
+            p->overflow_udata, &p->markbits_base, &p->markbits_sz,
+            0, mark_bytes(count), OSCAR_CACHE_LINE);
+        if (markbits == NULL) return -1;
+        memcpy(markbits, p->markbits, mark_bytes(primary));
+    } else {
+        markbits = (uint64_t *) resize_region_cb(p->overflow_cb,
+            p->overflow_udata, &p->markbits_base, &p->markbits_sz,
+            mark_bytes(keep), mark_bytes(count), OSCAR_CACHE_LINE);
+        if (markbits == NULL) return -1;
+    }
+    p->markbits = markbits;
+    if (count > keep) unmark_range(p, keep, count);
+
+    /* If this fails, the larger bitmap is harmless. */
+    cells = resize_region_cb(p->overflow_cb, p->overflow_udata,
+        &p->overflow, &p->overflow_sz, (keep - primary) * p->cell_sz,
+        ov * p->cell_sz, p->cell_align);
+    if (cells == NULL) return -1;
     p->count = count;
     return 0;
 }
 
-/* Get a fresh pool ID. Can cause a blocking sweep pass, and may cause
- * the pool's backing cells to move in memory (making any pointers stale).
- * Returns OSCAR_ID_NONE (-1) on error. */
-pool_id oscar_alloc(oscar *pool) {
-    pool_id id = find_unmarked(pool, pool->sweep);
-    unsigned int three_quarters = 0;
-    if (id != OSCAR_ID_NONE) return id;
+/* Spill a mostly live fixed pool into more overflow cells: a quarter
+ * of its own cells at first, then doubling, up to its limits. */
+static int grow_overflow(oscar *p) {
+    size_t primary = p->raw_count, ov = p->count - primary;
+    size_t limit = p->overflow_max;
+    if (limit > p->max_count - primary) limit = p->max_count - primary;
+    if (limit > SIZE_MAX / p->cell_sz) limit = SIZE_MAX / p->cell_sz;
+    if (ov >= limit) return -1;
+    ov = (ov == 0 ? primary / 4 : 2 * ov);
+    if (ov == 0) ov = 1;
+    if (ov > limit) ov = limit;
+    return resize_overflow(p, ov);
+}
 
-    LOG(" -- about to mark\n");
+/* Once less than half of a spilled pool is live, give back the overflow
+ * past its last live cell, keeping enough cells that the pool stays
+ * under half live (so it doesn't spill again right away). The cells
+ * given back are swept first. */
+static void shrink_overflow(oscar *p) {
+    size_t primary = p->raw_count, last = p->count, keep = 0, id = 0;
+    if (p->count <= primary || p->marked >= p->count / 2) return;
+    while (last > primary) {
+        if (MARK_WORD(p, (last - 1) / WORD_BITS) == 0) {
+            last -= (last - 1) % WORD_BITS + 1; /* a word of dead cells */
+        } else if (MARK_TEST(p, last - 1)) {
+            break;
+        } else {
+            last--;
+        }
+    }
+    keep = 2 * p->marked;
+    if (keep < last) keep = last;
+    if (keep < primary) keep = primary;
+    if (keep >= p->count) return;
+    LOG(" -- shrinking overflow to %lu cells\n", (unsigned long) (keep - primary));
+    for (id = keep; id < p->count; id++) sweep_cell(p, (pool_id) id);
+    if (resize_overflow(p, keep - primary) < 0) {
+        LOG(" -- shrinking failed\n"); /* the swept cells stay unused */
+    }
+}
+
+/* Call the watermark callback if the live cells just crossed it. */
+static void check_watermark(oscar *pool) {
+    int above = (pool->marked >= pool->watermark);
+    int was = ((pool->flags & OSCAR_FLAG_ABOVE_WATERMARK) != 0);
+    if (pool->watermark_cb == NULL || above == was) return;
+    pool->flags ^= OSCAR_FLAG_ABOVE_WATERMARK;
+    pool->watermark_cb(pool, pool->marked, above, pool->watermark_udata);
+}
+
+/* Mark the ID'th cell, atomically if the pool marks concurrently.
+ * Returns nonzero if it was newly marked. */
+static int mark_cell(oscar *pool, pool_id id) {
+    if (pool->concurrent) return oscar_concurrent_mark(pool, id);
+    return oscar_mark_unchecked(pool, id);
+}
+
+/* Mark the reservations of POOL's open scopes, so they stay live. */
+static void mark_scopes(oscar *pool) {
+    oscar_scope *s = NULL;
+    for (s = pool->scopes; s != NULL; s = s->outer) {
+        (void) mark_cell(pool, s->start);
+    }
+}
+
+/* Is ID in the pool and marked? */
+static int is_marked(oscar *pool, pool_id id) {
+    return id < pool->count && MARK_TEST(pool, id) != 0;
+}
+
+int oscar_is_marked(oscar *pool, pool_id id) { return is_marked(pool, id); }
+
+int oscar_mark_ephemerons(oscar *pool) {
+    oscar_ephemeron *e = NULL;
+    int newly = 0;
+    for (e = pool->ephemerons; e != NULL; e = e->next) {
+        if (!is_marked(pool, e->key) || e->value >= pool->count) continue;
+        if (!mark_cell(pool, e->value)) continue;
+        if (pool->ephemeron_cb
+            && pool->ephemeron_cb(pool, e->value, pool->ephemeron_udata) < 0) {
+            return -1;
+        }
+        newly++;
+    }
+    return newly;
+}
+
+/* Clear dead weak refs and ephemerons in one pass over each list. */
+void oscar_clear_weak(oscar *pool) {
+    oscar_weak_ref *w = NULL;
+    oscar_ephemeron *e = NULL;
+    for (e = pool->ephemerons; e != NULL; e = e->next) {
+        if (!is_marked(pool, e->key)) e->key = e->value = OSCAR_ID_NONE;
+    }
+    for (w = pool->weak_refs; w != NULL; w = w->next) {
+        if (!is_marked(pool, w->id)) w->id = OSCAR_ID_NONE;
+    }
+}
+
+/* Finish marking: trace through ephemerons until no more values are
+ * reached, then clear what died. Returns <0 on error. */
+static int end_mark(oscar *pool) {
+    int newly = 0;
+    while ((newly = oscar_mark_ephemerons(pool)) > 0) {}
+    if (newly < 0) return -1;
+    oscar_clear_weak(pool);
+    return 0;
+}
+
+/* Clear all mark bits and restart the lazy sweep. Epoch marks flip
+ * their sense instead, once every cell the sweep hasn't passed yet is
+ * made to look marked like the ones it has -- so if the sweep is done,
+ * this is O(1). */
+static void clear_marks(oscar *pool) {
+    if (pool->flags & OSCAR_FLAG_EPOCH_MARKS) {
+        size_t w = pool->sweep / WORD_BITS;
+        size_t words = (pool->count + WORD_BITS - 1) / WORD_BITS;
+        for (; w < words; w++) pool->markbits[w] = ~pool->mark_flip;
+        pool->mark_flip = ~pool->mark_flip;
+    } else {
+        bzero(pool->markbits, mark_bytes(pool->count));
+    }
     pool->marked = 0;
+    pool->sweep = 0;
+    pool->preswept = 0;
+}
 
-    /* Since the mark_cb is a user-supplied callback, it could potentially
-     * interleave the marking step with other work that doesn't disrupt
-     * the pool's data. Dangerous, but worth noting. */
-    if (pool->mark_cb(pool, pool->mark_udata) < 0) return OSCAR_ID_NONE;
+/* Once marking is done, record every marked cell in POOL's trace. The
+ * marks are read back from the mark bits, so the ones made inline, by
+ * a group, or on a concurrent collector thread are recorded too. */
+static void trace_marks(oscar *pool) {
+    size_t w = 0, words = (pool->count + WORD_BITS - 1) / WORD_BITS;
+    for (w = 0; w < words; w++) {
+        uint64_t bits = MARK_WORD(pool, w);
+        while (bits != 0) {
+            size_t id = w * WORD_BITS + ctz64(bits);
+            bits &= bits - 1;
+            if (id < pool->count) oscar_trace_marked(pool, (pool_id) id);
+        }
+    }
+}
+
+/* After marking, grow the pool if it's mostly live, and restart the
+ * lazy sweep. Returns <0 on error. */
+static int end_collect(oscar *pool) {
+    size_t three_quarters = 0;
+
+    if (pool->trace) trace_marks(pool);
+    if (pool->profile) oscar_profile_collected(pool);
 
     /* If >= 75% of the cells were marked, try to grow the pool (if possible)
-     * to avoid garbage collection churn.
-     * Note: does not attempt to shrink, because the pool is not compacted. */
+     * to avoid garbage collection churn. A fixed pool can only spill into
+     * its overflow; when that's full, allocation fails as usual.
+     * Note: only the overflow shrinks, as the pool is not compacted. */
     three_quarters = (pool->count < 4 ? 1 : pool->count - (pool->count >> 2));
-    LOG(" -- marked: %u, 3/4: %u\n", pool->marked, three_quarters);
+    LOG(" -- marked: %lu, 3/4: %lu\n",
+        (unsigned long) pool->marked, (unsigned long) three_quarters);
     if (pool->mem_cb && pool->marked >= three_quarters) {
         LOG(" -- trying to grow\n");
         if (grow_pool(pool) < 0) {
             LOG(" -- growth failed\n");
-            return OSCAR_ID_NONE;
+            return -1;
         }
+    } else if (pool->overflow_max > 0 && pool->marked >= three_quarters) {
+        LOG(" -- trying to spill\n");
+        if (grow_overflow(pool) < 0) LOG(" -- spilling failed\n");
+    } else {
+        shrink_overflow(pool);
     }
 
     pool->sweep = 0;            /* start from beginning */
+    pool->preswept = 0;
+    if (pool->trace) oscar_trace_gc(pool, 1);
+    check_watermark(pool);
+    return 0;
+}
+
+/* Finish a concurrent cycle, if one is marking. Returns <0 on error. */
+static int finish_marking(oscar *pool) {
+    if (!oscar_concurrent_marking(pool)) return 0;
+    if (oscar_concurrent_finish(pool) < 0) return -1;
+    return end_collect(pool);
+}
+
+/* Run the mark callback, then grow the pool if it's mostly live.
+ * The mark bits must already be clear. Returns <0 on error. */
+static int collect(oscar *pool) {
+    if (pool->concurrent) {     /* one whole cycle, waiting for it */
+        if (oscar_concurrent_begin(pool, 0) < 0) return -1;
+        return finish_marking(pool);
+    }
+    LOG(" -- about to mark\n");
+    if (pool->trace) oscar_trace_gc(pool, 0);
+    pool->marked = 0;
+    mark_scopes(pool);
+
+    /* Since the mark_cb is a user-supplied callback, it could potentially
+     * interleave the marking step with other work that doesn't disrupt
+     * the pool's data. Dangerous, but worth noting. */
+    if (pool->mark_cb(pool, pool->mark_udata) < 0) return -1;
+
+    pool->cycles++;
+    if (end_mark(pool) < 0) return -1;
+    return end_collect(pool);
+}
 
+/* Allocate from a pool that marks concurrently. A new cycle starts
+ * once the lazy sweep is halfway through the pool -- before allocating,
+ * so the new cell is allocated black. While a cycle is marking, cells
+ * come from its headroom, unless the collector is done (or, if
+ * MAY_COLLECT, the headroom runs out), in which case the cycle is
+ * finished first. Otherwise, the lazy sweep is used as usual. */
+static pool_id alloc_concurrently(oscar *pool, int may_collect) {
+    pool_id id = OSCAR_ID_NONE;
+    if (may_collect && !oscar_concurrent_marking(pool)
+        && pool->sweep >= pool->count / 2
+        && oscar_concurrent_begin(pool, 1) < 0) {
+        return OSCAR_ID_NONE;
+    }
+    if (oscar_concurrent_marking(pool)) {
+        if (!may_collect || !oscar_concurrent_done(pool)) {
+            id = oscar_concurrent_alloc(pool);
+            if (id != OSCAR_ID_NONE || !may_collect) return id;
+        }
+        if (finish_marking(pool) < 0) return OSCAR_ID_NONE;
+    }
+
+    id = find_unmarked(pool, pool->sweep);
+    if (id != OSCAR_ID_NONE || !may_collect) return id;
+    if (collect(pool) < 0) return OSCAR_ID_NONE;
+    return find_unmarked(pool, 0);
+}
+
+/* Get a fresh pool ID. Can cause a blocking sweep pass, and may cause
+ * the pool's backing cells to move in memory (making any pointers stale).
+ * Returns OSCAR_ID_NONE (-1) on error. */
+pool_id oscar_alloc(oscar *pool) {
+    pool_id id = OSCAR_ID_NONE;
+    if (pool->flags & OSCAR_FLAG_READER) return OSCAR_ID_NONE;
+    if (pool->concurrent) return alloc_concurrently(pool, 1);
+    id = find_unmarked(pool, pool->sweep);
+    if (id != OSCAR_ID_NONE) return id;
+    /* The sweep has cleared plain mark bits; epoch marks still flip. */
+    if (pool->flags & OSCAR_FLAG_EPOCH_MARKS) clear_marks(pool);
+    if (collect(pool) < 0) return OSCAR_ID_NONE;
     return find_unmarked(pool, 0);
 }
 
+/* Find the first run of N free cells at or after START, without
+ * sweeping anything. Free cells are those the lazy sweep hasn't reached
+ * yet that are unmarked, or continue an unmarked span. */
+static pool_id find_free_run(oscar *pool, size_t start, size_t n) {
+    size_t i = 0, run = 0;
+    int head_free = 0;          /* is the current span's first cell free? */
+    for (i = start; i < pool->count; i++) {
+        size_t w = i / WORD_BITS;
+        int is_free = 0;
+        if (i % WORD_BITS == 0 && i + WORD_BITS <= pool->count
+            && (MARK_WORD(pool, w) & ~pool->spanbits[w]) == ~(uint64_t) 0) {
+            run = 0;            /* a whole word of live cells */
+            head_free = 0;
+            i += WORD_BITS - 1;
+            continue;
+        }
+        if (BIT_TEST(pool->spanbits, i)) {
+            is_free = head_free;
+        } else {
+            is_free = head_free = !MARK_TEST(pool, i);
+        }
+        if (!is_free) {
+            run = 0;
+        } else if (++run == n) {
+            return (pool_id) (i + 1 - n);
+        }
+    }
+    return OSCAR_ID_NONE;
+}
+
+/* Get a fresh pool ID from the lazy sweep, without collecting. */
+pool_id oscar_try_alloc(oscar *pool) {
+    if (pool->flags & OSCAR_FLAG_READER) return OSCAR_ID_NONE;
+    if (pool->concurrent) return alloc_concurrently(pool, 0);
+    return find_unmarked(pool, pool->sweep);
+}
+
+/* Has the lazy sweep run out of free cells? This looks ahead of the
+ * sweep like find_unmarked, but without sweeping or resetting marks,
+ * so live cells left in the way don't count. While a concurrent cycle
+ * is marking, the bits can't be read, so it's up to the collector. */
+int oscar_gc_needed(oscar *pool) {
+    size_t w = pool->sweep / WORD_BITS;
+    size_t words = (pool->count + WORD_BITS - 1) / WORD_BITS;
+    uint64_t below = (((uint64_t) 1) << (pool->sweep % WORD_BITS)) - 1;
+    if (oscar_concurrent_marking(pool)) return oscar_concurrent_done(pool);
+
+    for (; w < words; w++, below = 0) {
+        uint64_t span = (pool->spanbits ? pool->spanbits[w] : 0);
+        uint64_t free_bits = ~(MARK_WORD(pool, w) | below | span);
+        if (free_bits != 0) {
+            return w * WORD_BITS + ctz64(free_bits) >= pool->count;
+        }
+    }
+    return 1;
+}
+
+/* Mark (and maybe grow) now, restarting the lazy sweep. */
+int oscar_collect(oscar *pool) {
+    if (pool->flags & OSCAR_FLAG_READER) return -1;
+    if (finish_marking(pool) < 0) return -1;
+    clear_marks(pool);
+    return collect(pool);
+}
+
+/* Sweep up to N cells ahead of the lazy sweep, so later allocations
+ * can hand them out without calling free_cb. */
+size_t oscar_sweep_step(oscar *pool, size_t n) {
+    size_t i = (pool->preswept > pool->sweep ? pool->preswept : pool->sweep);
+    size_t end = (n < pool->count - i ? i + n : pool->count);
+    if (pool->flags & OSCAR_FLAG_READER) return 0;
+    if (oscar_concurrent_marking(pool)) return pool->count - i;
+    while (i < end) {
+        size_t w = i / WORD_BITS;
+        uint64_t free_bits = ~MARK_WORD(pool, w) >> (i % WORD_BITS);
+        if (pool->spanbits) free_bits &= ~pool->spanbits[w] >> (i % WORD_BITS);
+        if (free_bits == 0) {   /* no dead cells in the rest of the word */
+            i += WORD_BITS - i % WORD_BITS;
+            continue;
+        }
+        i += ctz64(free_bits);
+        if (i >= end) break;
+        sweep_cell(pool, (pool_id) i);
+        i++;
+    }
+    pool->preswept = (pool_id) end;
+    return pool->count - end;
+}
+
+/* Reserve N contiguous free cells as a span, and return its first ID.
+ * Can collect and grow the pool. */
+static pool_id reserve_run(oscar *pool, size_t n) {
+    pool_id id = OSCAR_ID_NONE;
+    size_t i = 0;
+    if (pool->mem_cb == NULL || n == 0 || n > pool->max_count
+        || (pool->flags & OSCAR_FLAG_READER)) {
+        return OSCAR_ID_NONE;
+    }
+    if (finish_marking(pool) < 0) return OSCAR_ID_NONE;
+    if (resize_bitmap(pool, &pool->spanbits, &pool->spanbits_base,
+            &pool->spanbits_sz, pool->count, 1) < 0) {
+        return OSCAR_ID_NONE;
+    }
+
+    id = find_free_run(pool, pool->sweep, n);
+    if (id == OSCAR_ID_NONE) {
+        /* The rest of the pool may be fragmented, so collect, then grow
+         * until there is room. */
+        clear_marks(pool);
+        if (collect(pool) < 0) return OSCAR_ID_NONE;
+        while ((id = find_free_run(pool, 0, n)) == OSCAR_ID_NONE) {
+            if (grow_pool(pool) < 0) return OSCAR_ID_NONE;
+        }
+    }
+
+    /* Sweep whatever was there, then mark the first cell so the lazy
+     * sweep treats the span as live until the next collection. */
+    for (i = id; i < id + n; i++) {
+        if (!BIT_TEST(pool->spanbits, i)) sweep_cell(pool, (pool_id) i);
+    }
+    (void) mark_cell(pool, id);
+    set_bit_range(pool->spanbits, (size_t) id + 1, id + n, 1);
+    if (pool->profile) oscar_profile_allocated(pool, id);
+    if (pool->trace) oscar_trace_allocated(pool, id, n);
+    return id;
+}
+
+/* Get N contiguous cells under one ID. */
+pool_id oscar_alloc_span(oscar *pool, size_t n) {
+    if (n == 1) return oscar_alloc(pool);
+    return reserve_run(pool, n);
+}
+
+/* Open a scope, reserving COUNT cells for it as one span. */
+int oscar_scope_begin(oscar *pool, oscar_scope *scope, size_t count) {
+    pool_id start = OSCAR_ID_NONE;
+    if (pool->mem_cb == NULL || (pool->flags & OSCAR_FLAG_READER)) return -1;
+    if (resize_bitmap(pool, &pool->escapebits, &pool->escapebits_base,
+            &pool->escapebits_sz, pool->count, 1) < 0) {
+        return -1;
+    }
+    start = reserve_run(pool, count);
+    if (start == OSCAR_ID_NONE) return -1;
+
+    scope->pool = pool;
+    scope->start = scope->next = start;
+    scope->end = (pool_id) (start + count);
+    scope->outer = pool->scopes;
+    pool->scopes = scope;
+    return 0;
+}
+
+/* Get the next cell from SCOPE's reservation. */
+pool_id oscar_scope_alloc(oscar_scope *scope) {
+    if (scope->next == scope->end) return OSCAR_ID_NONE;
+    return scope->next++;
+}
+
+/* Keep ID alive past the end of its scope. */
+void oscar_scope_escape(oscar_scope *scope, pool_id id) {
+    if (id < scope->start || id >= scope->next) return;
+    set_bit_range(scope->pool->escapebits, id, (size_t) id + 1, 1);
+}
+
+/* Is ID one of the cells SCOPE is releasing: handed out, and not
+ * escaped? */
+static int scope_releases(oscar_scope *scope, pool_id id) {
+    return id != OSCAR_ID_NONE && id >= scope->start && id < scope->next
+        && !BIT_TEST(scope->pool->escapebits, id);
+}
+
+/* Clear the weak refs to cells SCOPE is releasing, and the ephemerons
+ * whose keys or values are among them, as a collection would have. */
+static void clear_released_weak(oscar_scope *scope) {
+    oscar_weak_ref *w = NULL;
+    oscar_ephemeron *e = NULL;
+    for (e = scope->pool->ephemerons; e != NULL; e = e->next) {
+        if (scope_releases(scope, e->key) || scope_releases(scope, e->value)) {
+            e->key = e->value = OSCAR_ID_NONE;
+        }
+    }
+    for (w = scope->pool->weak_refs; w != NULL; w = w->next) {
+        if (scope_releases(scope, w->id)) w->id = OSCAR_ID_NONE;
+    }
+}
+
+/* Close SCOPE, releasing every cell it handed out but didn't escape. */
+void oscar_scope_end(oscar_scope *scope) {
+    oscar *pool = scope->pool;
+    oscar_scope **link = &pool->scopes;
+    size_t start = scope->start, end = scope->end, i = 0, run = 0;
+
+    while (*link != NULL && *link != scope) link = &(*link)->outer;
+    if (*link == NULL) return;  /* not open */
+    (void) finish_marking(pool); /* the bits below can't change meanwhile */
+    *link = scope->outer;
+    if (pool->flags & OSCAR_FLAG_MAPPED_CELLS) oscar_shared_released(pool);
+
+    /* Finalize the released cells in one pass, then zero each run of
+     * them at once. Cells past NEXT were never handed out, so they are
+     * still zero from when the scope was reserved. */
+    for (i = start; i <= scope->next; i++) {
+        if (i < scope->next && !BIT_TEST(pool->escapebits, i)) {
+            if (pool->free_cb) pool->free_cb(pool, (pool_id) i, pool->free_udata);
+            if (pool->profile) oscar_profile_swept(pool, (pool_id) i);
+            run++;
+            continue;
+        }
+        if (run > 0) {
+            bzero(cell_ptr(pool, (pool_id) (i - run)),
+                run * pool->cell_sz);
+            run = 0;
+        }
+    }
+    clear_released_weak(scope);
+
+    /* Dissolve the span, so every cell is on its own again. Released
+     * cells are left unmarked for reuse; escaped cells stay live until
+     * the next collection, like freshly allocated ones. If the lazy
+     * sweep is partway through the range, back it up to reuse it now.
+     * (With epoch marks, any cells it has passed must still look marked
+     * until the next collection, so they aren't unmarked.) */
+    set_bit_range(pool->spanbits, start + 1, end, 0);
+    if (pool->sweep >= start && pool->sweep <= end) {
+        pool->sweep = (pool_id) start;
+    }
+    if (pool->flags & OSCAR_FLAG_EPOCH_MARKS) {
+        unmark_range(pool, (pool->sweep > start ? pool->sweep : start), end);
+    } else {
+        set_bit_range(pool->markbits, start, end, 0);
+    }
+    for (i = start; i < scope->next; i++) {
+        if (!BIT_TEST(pool->escapebits, i)) continue;
+        set_bit_range(pool->escapebits, i, i + 1, 0);
+        if (i >= pool->sweep) (void) mark_cell(pool, (pool_id) i);
+    }
+    scope->pool = NULL;
+}
+
+void oscar_weak_init(oscar *pool, oscar_weak_ref *ref, pool_id id) {
+    ref->pool = pool;
+    ref->id = id;
+    ref->prev = NULL;
+    ref->next = pool->weak_refs;
+    if (ref->next) ref->next->prev = ref;
+    pool->weak_refs = ref;
+}
+
+/* While a cycle marks concurrently, a weak target the mutator gets
+ * could be stored where the collector has already looked, so it is
+ * kept alive as if a reference to it were being overwritten. */
+pool_id oscar_weak_get(oscar_weak_ref *ref) {
+    if (ref->pool->concurrent) oscar_write_barrier(ref->pool, ref->id);
+    return ref->id;
+}
+
+void oscar_weak_set(oscar_weak_ref *ref, pool_id id) { ref->id = id; }
+
+void oscar_weak_release(oscar_weak_ref *ref) {
+    if (ref->prev) {
+        ref->prev->next = ref->next;
+    } else {
+        ref->pool->weak_refs = ref->next;
+    }
+    if (ref->next) ref->next->prev = ref->prev;
+    ref->id = OSCAR_ID_NONE;
+    ref->prev = ref->next = NULL;
+}
+
+void oscar_set_ephemeron_cb(oscar *pool, oscar_ephemeron_cb *cb,
+                            void *udata) {
+    pool->ephemeron_cb = cb;
+    pool->ephemeron_udata = udata;
+}
+
+void oscar_ephemeron_init(oscar *pool, oscar_ephemeron *e,
+                          pool_id key, pool_id value) {
+    e->pool = pool;
+    e->key = key;
+    e->value = value;
+    e->prev = NULL;
+    e->next = pool->ephemerons;
+    if (e->next) e->next->prev = e;
+    pool->ephemerons = e;
+}
+
+pool_id oscar_ephemeron_key(oscar_ephemeron *e) {
+    if (e->pool->concurrent) oscar_write_barrier(e->pool, e->key);
+    return e->key;
+}
+
+pool_id oscar_ephemeron_value(oscar_ephemeron *e) {
+    if (e->pool->concurrent) oscar_write_barrier(e->pool, e->value);
+    return e->value;
+}
+
+void oscar_ephemeron_release(oscar_ephemeron *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        e->pool->ephemerons = e->next;
+    }
+    if (e->next) e->next->prev = e->prev;
+    e->key = e->value = OSCAR_ID_NONE;
+    e->prev = e->next = NULL;
+}
+
+/* Clear all mark bits and restart the lazy sweep, before marking. */
+void oscar_begin_mark(oscar *pool) {
+    clear_marks(pool);
+    pool->cycles++;
+    if (pool->trace) oscar_trace_gc(pool, 0);
+    mark_scopes(pool);
+}
+
+int oscar_end_collect(oscar *pool) { return end_collect(pool); }
+
+/* Finish a forced collection: shrink the overflow, and sweep every dead
+ * cell now rather than lazily. */
+static void end_force_gc(oscar *pool) {
+    if (pool->trace) trace_marks(pool);
+    if (pool->profile) oscar_profile_collected(pool);
+    shrink_overflow(pool);
+    if (pool->trace) oscar_trace_gc(pool, 1);
+    oscar_sweep_all(pool);
+    check_watermark(pool);
+}
+
+void oscar_end_force_gc(oscar *pool) { end_force_gc(pool); }
+
+/* Sweep every unmarked cell now, but leave the mark bits, so the lazy
+ * sweep skips live cells rather than handing them out again.
+ * Swept cells are zeroed, so if the lazy sweep passes one again
+ * before it is reused, free_cb just sees a never-allocated cell. */
+void oscar_sweep_all(oscar *pool) {
+    size_t w = 0, words = (pool->count + WORD_BITS - 1) / WORD_BITS;
+    for (w = 0; w < words; w++) {
+        uint64_t free_bits = ~MARK_WORD(pool, w);
+        if (pool->spanbits) free_bits &= ~pool->spanbits[w];
+        while (free_bits != 0) {
+            pool_id id = (pool_id) (w * WORD_BITS + ctz64(free_bits));
+            if (id >= pool->count) break;
+            sweep_cell(pool, id);
+            free_bits &= free_bits - 1;
+        }
+    }
+    pool->sweep = 0;
+}
+
+int oscar_foreach_live(oscar *pool, oscar_live_cb *cb, void *udata) {
+    return oscar_foreach_live_range(pool, 0, pool->count, cb, udata);
+}
+
+int oscar_foreach_live_range(oscar *pool, size_t first, size_t last,
+                             oscar_live_cb *cb, void *udata) {
+    size_t w = first / WORD_BITS;
+    /* Bits below FIRST in the first word are skipped. */
+    uint64_t below = (((uint64_t) 1) << (first % WORD_BITS)) - 1;
+    if (last > pool->count) last = pool->count;
+
+    for (; w * WORD_BITS < last; w++, below = 0) {
+        uint64_t live = MARK_WORD(pool, w) & ~below;
+        while (live != 0) {
+            size_t id = w * WORD_BITS + ctz64(live);
+            int res = 0;
+            if (id >= last) return 0;
+            res = cb(pool, (pool_id) id,
+                cell_ptr(pool, (pool_id) id), udata);
+            if (res < 0) return res;
+            live &= live - 1;
+        }
+    }
+    return 0;
+}
+
+void oscar_live_iter_init(oscar *pool, oscar_live_iter *it) {
+    it->pool = pool;
+    it->word = 0;
+    it->bits = MARK_WORD(pool, 0);
+}
+
+pool_id oscar_live_next(oscar_live_iter *it) {
+    size_t words = (it->pool->count + WORD_BITS - 1) / WORD_BITS;
+    size_t id = 0;
+    while (it->bits == 0) {
+        if (++it->word >= words) return OSCAR_ID_NONE;
+        it->bits = MARK_WORD(it->pool, it->word);
+    }
+    id = it->word * WORD_BITS + ctz64(it->bits);
+    if (id >= it->pool->count) {
+        it->bits = 0;
+        it->word = words;
+        return OSCAR_ID_NONE;
+    }
+    it->bits &= it->bits - 1;
+    return (pool_id) id;
+}
+
 /* Force a full GC mark/sweep. If free_cb is defined, it will be called
  * on every swept cell. Returns <0 on error. */
 int oscar_force_gc(oscar *pool) {
-    pool_id id = 0;
     LOG(" -- forcing GC\n");
-    pool->marked = 0;
-    bzero(pool->markbits, (pool->count / 8) + 1);
-    if (pool->mark_cb(pool, pool->mark_udata) < 0) return -1;
-
-    for (id = 0; id < pool->count; id++) {
-        if (!check_and_clear_mark(pool->markbits, id)) {
-            if (pool->free_cb) pool->free_cb(pool, id, pool->free_udata);
-            LOG("-- sweeping unmarked cell, %d\n", id);
+    if (pool->flags & OSCAR_FLAG_READER) return -1;
+    if (pool->concurrent) {
+        if (finish_marking(pool) < 0
+            || oscar_concurrent_begin(pool, 0) < 0
+            || oscar_concurrent_finish(pool) < 0) {
+            return -1;
         }
+    } else {
+        oscar_begin_mark(pool);
+        if (pool->mark_cb(pool, pool->mark_udata) < 0) return -1;
+        if (end_mark(pool) < 0) return -1;
     }
-    pool->sweep = 0;
-    bzero(pool->raw, pool->sz);
+    end_force_gc(pool);
     return 0;
 }
 
 /* Free the pool and its contents. If the memory was dynamically allocated,
  * it will be freed; if a free_cb is defined, it will be called on every cell. */
 void oscar_free(oscar *pool) {
-    unsigned int id = 0;
+    pool_id id = 0;
+    oscar_concurrent_abandon(pool);
     if (pool->free_cb) {
-        for (id = 0; id < pool->count; id++) {
+        for (id = 0; id < pool->count; id += span_cells(pool, id)) {
             pool->free_cb(pool, id, pool->free_udata);
         }
     }
 
+    oscar_profile_stop(pool);
+    (void) oscar_trace_stop(pool);
+
     if (pool->mem_cb) {  /* Don't free if using a fixed-size allocator. */
-        pool->mem_cb(pool->raw, pool->sz, 0, pool->mem_udata);
+        pool->mem_cb(pool->raw_base, pool->sz, 0, pool->mem_udata);
+        pool->mem_cb(pool->markbits_base, pool->markbits_sz, 0,
+            pool->mem_udata);
+        if (pool->spanbits_base) {
+            pool->mem_cb(pool->spanbits_base, pool->spanbits_sz, 0,
+                pool->mem_udata);
+        }
+        if (pool->escapebits_base) {
+            pool->mem_cb(pool->escapebits_base, pool->escapebits_sz, 0,
+                pool->mem_udata);
+        }
         pool->mem_cb(pool, sizeof(*pool), 0, pool->mem_udata);
+    } else if (pool->overflow) {  /* but do free a fixed pool's overflow */
+        (void) resize_overflow(pool, 0);
     }
 }
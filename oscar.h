@@ -17,8 +17,15 @@
 #ifndef OSCAR_H
 #define OSCAR_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Unsigned int for pool IDs, can be defined at compile-time
- * to use <4 bytes. */
+ * to use <4 bytes, or as uint64_t for pools of more than 2^32 cells. */
 #ifdef OSCAR_POOL_ID_TYPE
 typedef OSCAR_POOL_ID_TYPE pool_id;
 #else
@@ -28,6 +35,10 @@ typedef uint32_t pool_id;
 /* Opaque struct for the GC internals. */
 typedef struct oscar oscar;
 
+/* Cache line size, in bytes. The mark bits are aligned to this, and it
+ * can be passed to oscar_new_aligned to give every cell its own lines. */
+#define OSCAR_CACHE_LINE 64
+
 /* Special sentinel value for "no ID". */
 #define OSCAR_ID_NONE ((pool_id) -1)
 
@@ -56,19 +67,88 @@ void *oscar_generic_mem_cb(void *p, size_t old_sz, size_t new_sz, void *udata);
  * cells as will fit inside the BYTES bytes pointed to by MEMORY.
  * For the various callbacks, see their typedefs.
  * Return NULL on error, such as if the provided memory in insufficient. */
-oscar *oscar_new_fixed(unsigned int cell_sz, unsigned int bytes, char *memory,
+oscar *oscar_new_fixed(size_t cell_sz, size_t bytes, char *memory,
                        oscar_mark_cb *mark_cb, void *mark_udata,
                        oscar_free_cb *free_cb, void *free_udata);
 
 /* Init a resizable garbage-collected pool of START_COUNT cells,
- * each CELL_SZ bytes. For the various callbacks, see their typedefs. */
-oscar *oscar_new(unsigned int cell_sz, unsigned int start_count,
+ * each CELL_SZ bytes. For the various callbacks, see their typedefs.
+ * Returns NULL if the pool's size would overflow a size_t, or if
+ * START_COUNT cells would not all be addressable by a pool_id. */
+oscar *oscar_new(size_t cell_sz, size_t start_count,
+    oscar_memory_cb *mem_cb, void *mem_udata,
+    oscar_mark_cb *mark_cb, void *mark_udata,
+    oscar_free_cb *free_cb, void *free_udata);
+
+/* Like oscar_new, but every cell starts on a CELL_ALIGN-byte boundary
+ * (a power of two, such as OSCAR_CACHE_LINE). CELL_SZ is rounded up
+ * to a multiple of CELL_ALIGN. */
+oscar *oscar_new_aligned(size_t cell_sz, size_t cell_align,
+    size_t start_count,
     oscar_memory_cb *mem_cb, void *mem_udata,
     oscar_mark_cb *mark_cb, void *mark_udata,
     oscar_free_cb *free_cb, void *free_udata);
 
+/* Get how many bytes oscar_new_fixed needs at MEMORY for a pool of
+ * COUNT CELL_SZ-byte cells, including its bookkeeping and padding.
+ * If MEMORY is NULL, assume the worst case for its alignment.
+ * Returns 0 if that would overflow a size_t. */
+size_t oscar_fixed_size(size_t cell_sz, size_t count, const char *memory);
+
 /* Get the current cell count. */
-unsigned int oscar_count(oscar *pool);
+size_t oscar_count(oscar *pool);
+
+/* Statistics about a pool, from oscar_get_stats. */
+typedef struct oscar_stats {
+    size_t count;               /* number of cells */
+    size_t cell_sz;             /* bytes per cell */
+    size_t marked;              /* cells found live by the last mark */
+    size_t bytes;               /* bytes used for cells and mark bits */
+    size_t huge_bytes;          /* bytes advised to use transparent huge
+                                 * pages while they were enabled */
+    size_t collections;         /* mark phases run so far */
+} oscar_stats;
+
+/* Get statistics about the pool. */
+void oscar_get_stats(oscar *pool, oscar_stats *stats);
+
+/* Limit a dynamic pool to at most MAX_COUNT cells, so IDs can be
+ * packed into fewer bits. Returns <0 if the pool already has more
+ * cells than that. */
+int oscar_set_max_count(oscar *pool, size_t max_count);
+
+/* Let a fixed POOL spill into an overflow segment of up to MAX_CELLS
+ * more cells, allocated with MEM_CB, once a collection finds its own
+ * cells mostly live. Overflow cells follow the fixed ones in the same
+ * ID space, and the lazy sweep hands out the fixed ones first. As with
+ * a dynamic pool, overflow cells may move when the overflow grows. Once
+ * a collection finds less than half the pool live, the overflow shrinks
+ * back to its last live cell (it isn't compacted), and is freed when
+ * none are. Can't be changed while the pool has overflow cells.
+ * Returns <0 on error, such as if POOL isn't fixed. */
+int oscar_set_overflow(oscar *pool, size_t max_cells,
+    oscar_memory_cb *mem_cb, void *mem_udata);
+
+/* Callback for when a collection finds a pool's LIVE cells crossing
+ * its watermark: ABOVE is nonzero when they reach it, and 0 when they
+ * fall back below it. */
+typedef void (oscar_watermark_cb)(oscar *pool, size_t live, int above,
+                                  void *udata);
+
+/* Call CB whenever a collection finds POOL's live cells crossing
+ * WATERMARK, such as to warn before a fixed pool spills, or when a
+ * spilled one is about to run out. */
+void oscar_set_watermark(oscar *pool, size_t watermark,
+    oscar_watermark_cb *cb, void *udata);
+
+/* Switch POOL between plain mark bits (the default) and epoch marks.
+ * Plain mark bits are cleared before each collection: by the lazy sweep
+ * as it passes each word, or all at once if a collection starts before
+ * the sweep is done. Epoch marks flip their sense instead, so starting
+ * a collection after a full sweep is O(1), and the sweep reads the
+ * words of live cells without writing them -- which helps large, mostly
+ * live pools. Not for concurrent marking. Returns <0 on error. */
+int oscar_set_epoch_marks(oscar *pool, int on);
 
 /* Mark the ID'th cell as reachable. */
 void oscar_mark(oscar *pool, pool_id id);
@@ -83,6 +163,167 @@ void *oscar_get(oscar *pool, pool_id id);
  * Returns -1 on error. */
 pool_id oscar_alloc(oscar *pool);
 
+/* Get a fresh pool ID like oscar_alloc, but only from cells the lazy
+ * sweep can still find: this never calls mark_cb or grows the pool, so
+ * cell pointers stay valid. Returns OSCAR_ID_NONE if only a collection
+ * could provide a cell. */
+pool_id oscar_try_alloc(oscar *pool);
+
+/* Check whether the lazy sweep has run out of free cells, so the next
+ * oscar_alloc would collect (and oscar_try_alloc would fail). Cells
+ * ahead of the sweep are only looked at, not swept. Returns nonzero if
+ * so. */
+int oscar_gc_needed(oscar *pool);
+
+/* Collect now: call mark_cb, grow the pool if most of it is live (as
+ * oscar_alloc would), and restart the lazy sweep. Dead cells aren't
+ * swept until they are reached by allocation or oscar_sweep_step.
+ * Returns <0 on error. */
+int oscar_collect(oscar *pool);
+
+/* Sweep up to N of the cells the lazy sweep has yet to reach, calling
+ * free_cb on the dead ones, so that allocating them later is cheap.
+ * Returns how many cells are still left to sweep (0 when done). */
+size_t oscar_sweep_step(oscar *pool, size_t n);
+
+/* Get N contiguous cells under one ID, so oscar_get returns a flat array
+ * of N * CELL_SZ bytes. The span is a single unit to the GC: marking its
+ * ID keeps all of it, and if it is swept, free_cb is only called on its
+ * ID. Can collect and grow like oscar_alloc, and may also collect to find
+ * a long enough run of free cells. Only for dynamic pools.
+ * Returns OSCAR_ID_NONE on error. */
+pool_id oscar_alloc_span(oscar *pool, size_t n);
+
+/* Get how many cells ID covers: N for a span from oscar_alloc_span, or
+ * 1 for any other cell. Returns 0 if ID isn't in the pool or is inside
+ * a span rather than starting it. */
+size_t oscar_span_length(oscar *pool, pool_id id);
+
+/* A region of cells whose lifetime ends all at once, such as while
+ * handling one request. Callers provide the storage, e.g. on the stack;
+ * the fields are private. */
+typedef struct oscar_scope {
+    oscar *pool;
+    pool_id start;              /* first reserved cell */
+    pool_id next;               /* next cell to hand out */
+    pool_id end;                /* end of the reservation */
+    struct oscar_scope *outer;  /* enclosing open scope, if any */
+} oscar_scope;
+
+/* Open SCOPE on a dynamic POOL, reserving COUNT contiguous cells for it
+ * up front (which can collect and grow the pool, as oscar_alloc_span).
+ * Until the scope ends, the whole reservation is kept alive, but its
+ * cells are not roots: mark_cb still needs to mark any other cells
+ * they refer to. Returns <0 on error. */
+int oscar_scope_begin(oscar *pool, oscar_scope *scope, size_t count);
+
+/* Get a cell from SCOPE's reservation, without marking or sweeping.
+ * Returns OSCAR_ID_NONE once the reservation is used up. */
+pool_id oscar_scope_alloc(oscar_scope *scope);
+
+/* Keep ID, a cell from SCOPE, alive after the scope ends. It is then an
+ * ordinary cell, live until the next collection that doesn't reach it. */
+void oscar_scope_escape(oscar_scope *scope, pool_id id);
+
+/* Close SCOPE. Every cell it handed out that didn't escape is released
+ * at once: free_cb is called on each, in one pass, and the cells are
+ * zeroed and made available again without waiting for a collection. */
+void oscar_scope_end(oscar_scope *scope);
+
+/* A weak reference to a cell: it doesn't keep the cell alive, and is
+ * cleared to OSCAR_ID_NONE by the first collection that doesn't reach
+ * the cell, before the cell can be swept or reused. Callers provide the
+ * storage, e.g. inside a cache entry, and it must stay put until
+ * released; the fields are private. Cells released early by
+ * oscar_scope_end are cleared from weak refs at once. */
+typedef struct oscar_weak_ref {
+    oscar *pool;
+    pool_id id;                 /* target, or OSCAR_ID_NONE */
+    struct oscar_weak_ref *prev; /* neighbors in the pool's list */
+    struct oscar_weak_ref *next;
+} oscar_weak_ref;
+
+/* Register REF as a weak reference to ID (which may be OSCAR_ID_NONE)
+ * in POOL. */
+void oscar_weak_init(oscar *pool, oscar_weak_ref *ref, pool_id id);
+
+/* Get REF's target, or OSCAR_ID_NONE if it has been collected. */
+pool_id oscar_weak_get(oscar_weak_ref *ref);
+
+/* Point REF at ID instead. */
+void oscar_weak_set(oscar_weak_ref *ref, pool_id id);
+
+/* Unregister REF, so its storage can be reused. */
+void oscar_weak_release(oscar_weak_ref *ref);
+
+/* An ephemeron: a key -> value entry, such as in a cache table, which
+ * keeps its value alive only as long as something else keeps its key
+ * alive. The first collection that doesn't otherwise reach the key
+ * clears both to OSCAR_ID_NONE, as does oscar_scope_end releasing
+ * either. Storage is the caller's, as with oscar_weak_ref; the fields
+ * are private. */
+typedef struct oscar_ephemeron {
+    oscar *pool;
+    pool_id key;
+    pool_id value;
+    struct oscar_ephemeron *prev; /* neighbors in the pool's list */
+    struct oscar_ephemeron *next;
+} oscar_ephemeron;
+
+/* Callback to mark whatever VALUE, an ephemeron's value that was just
+ * marked because its key is live, refers to, as mark_cb would. It must
+ * not register or release ephemerons. Should return <0 on error. */
+typedef int (oscar_ephemeron_cb)(oscar *pool, pool_id value, void *udata);
+
+/* Set POOL's ephemeron callback. Without one, values are assumed to
+ * refer to nothing else in the pool. */
+void oscar_set_ephemeron_cb(oscar *pool, oscar_ephemeron_cb *cb,
+    void *udata);
+
+/* Register E as an ephemeron mapping KEY to VALUE in POOL. */
+void oscar_ephemeron_init(oscar *pool, oscar_ephemeron *e,
+    pool_id key, pool_id value);
+
+/* Get E's key or value, or OSCAR_ID_NONE if it has been collected. */
+pool_id oscar_ephemeron_key(oscar_ephemeron *e);
+pool_id oscar_ephemeron_value(oscar_ephemeron *e);
+
+/* Unregister E, so its storage can be reused. */
+void oscar_ephemeron_release(oscar_ephemeron *e);
+
+/* Callback for oscar_foreach_live, called with each live cell's ID and
+ * a pointer to it. Should return <0 to stop early. */
+typedef int (oscar_live_cb)(oscar *pool, pool_id id, void *cell, void *udata);
+
+/* Call CB on every cell marked live by the last collection, in ID (and
+ * address) order, skipping dead cells a bitmap word at a time. This is
+ * exact right after oscar_force_gc; after oscar_alloc has resumed lazy
+ * sweeping, cells it has passed or handed out aren't included (with
+ * epoch marks, they all are). A span is visited once, by its ID.
+ * Returns 0, or CB's result if it was <0. */
+int oscar_foreach_live(oscar *pool, oscar_live_cb *cb, void *udata);
+
+/* Like oscar_foreach_live, but only for IDs from FIRST up to (but not
+ * including) LAST. Since it only reads the pool, disjoint ranges can be
+ * walked in parallel, one per thread, as long as nothing allocates or
+ * collects meanwhile. */
+int oscar_foreach_live_range(oscar *pool, size_t first, size_t last,
+    oscar_live_cb *cb, void *udata);
+
+/* Iterator over live cells, as oscar_foreach_live. The fields are
+ * private. */
+typedef struct oscar_live_iter {
+    oscar *pool;
+    size_t word;                /* index of the current bitmap word */
+    uint64_t bits;              /* its live bits not yet visited */
+} oscar_live_iter;
+
+/* Start iterating over POOL's live cells. */
+void oscar_live_iter_init(oscar *pool, oscar_live_iter *it);
+
+/* Get the next live cell's ID, or OSCAR_ID_NONE when done. */
+pool_id oscar_live_next(oscar_live_iter *it);
+
 /* Force a full GC mark/sweep. If free_cb is defined, it will be called
  * on every swept cell. Returns <0 on error. */
 int oscar_force_gc(oscar *pool);
@@ -91,4 +332,8 @@ int oscar_force_gc(oscar *pool);
  * it will be freed; if a free_cb is defined, it will be called on every cell. */
 void oscar_free(oscar *pool);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,190 @@
+/* For copyright notice, see oscar.h. */
+
+#ifndef OSCAR_HPP
+#define OSCAR_HPP
+
+/* Typed C++ (C++11 or later) wrapper for oscar. A pool<T> stores one T
+ * per cell, with the cell size known at compile time, so indexing
+ * compiles down to a shift or LEA instead of a runtime multiply.
+ *
+ * Marking is driven by a hooks class rather than function pointers:
+ *
+ *     struct node { int value; oscarpp::handle<node> next; };
+ *
+ *     struct node_hooks {
+ *         template<typename Pool>
+ *         static void trace(const node &n, Pool &p) { p.mark(n.next); }
+ *         static void finalize(node &n) { }
+ *     };
+ *
+ *     oscarpp::pool<node, node_hooks> p;
+ *     oscarpp::pool<node, node_hooks>::root_scope roots(p);
+ *     oscarpp::handle<node> h = roots.add(p.alloc());
+ *
+ * Everything reachable from a live root_scope survives collection.
+ * trace is called once per reachable cell, from an explicit work list
+ * (so deep structures don't recurse), and finalize is called on every
+ * swept cell. As in the C API, finalize may see cells that were never
+ * allocated into, which are all zero bytes.
+ *
+ * Since cells are zeroed and moved with memcpy-like semantics as the
+ * pool grows, T must be trivially copyable. Any T * or T & becomes
+ * stale when alloc() causes the pool to grow.
+ *
+ * The C API is declared at global scope as usual, so the C headers may
+ * be included before or after this one. (The namespace can't be called
+ * oscar, since that's the C API's pool type.) */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+#include <vector>
+#include <type_traits>
+
+#include "oscar_inline.h"
+
+namespace oscarpp {
+
+/* Sentinel for "no ID", as OSCAR_ID_NONE. */
+constexpr pool_id id_none = static_cast<pool_id>(-1);
+
+/* A pool ID for a cell holding a T. */
+template<typename T>
+struct handle {
+    pool_id id;
+
+    handle() : id(id_none) {}
+    explicit handle(pool_id i) : id(i) {}
+
+    bool valid() const { return id != id_none; }
+    bool operator==(handle o) const { return id == o.id; }
+    bool operator!=(handle o) const { return id != o.id; }
+};
+
+/* Default hooks: cells have no outgoing references and no finalizer. */
+template<typename T>
+struct hooks {
+    template<typename Pool>
+    static void trace(const T &, Pool &) {}
+    static void finalize(T &) {}
+};
+
+template<typename T, typename Hooks = hooks<T> >
+class pool {
+    static_assert(std::is_trivially_copyable<T>::value,
+        "cells are zeroed and moved bytewise, so T must be trivially copyable");
+
+    static constexpr size_t round_up(size_t n, size_t to) {
+        return (n + to - 1) / to * to;
+    }
+    static constexpr size_t max(size_t a, size_t b) { return a > b ? a : b; }
+
+public:
+    /* Cell alignment: T's own, but at least oscar's minimum. */
+    static constexpr size_t cell_align = max(sizeof(void *), alignof(T));
+
+    /* Bytes per cell: sizeof(T), padded to CELL_ALIGN. */
+    static constexpr size_t cell_size =
+        round_up(max(sizeof(T), sizeof(pool_id)), cell_align);
+
+    /* Create a dynamically allocated pool with START_COUNT cells.
+     * Throws std::bad_alloc on failure. */
+    explicit pool(size_t start_count = 16)
+        : p_(oscar_new_aligned(cell_size, cell_align, start_count,
+                oscar_generic_mem_cb, NULL,
+                mark_cb, this, free_cb, NULL)) {
+        if (p_ == NULL) throw std::bad_alloc();
+    }
+
+    ~pool() { oscar_free(p_); }
+
+    pool(const pool &) = delete;
+    pool &operator=(const pool &) = delete;
+
+    /* Allocate a value-initialized T. May collect or grow the pool.
+     * Returns an invalid handle on error. */
+    handle<T> alloc() {
+        pool_id id = oscar_alloc(p_);
+        if (id != id_none) new (cell(id)) T();
+        return handle<T>(id);
+    }
+
+    /* Get a pointer to H's cell, or NULL if H is out of range. */
+    T *get(handle<T> h) {
+        return (h.id < p_->count ? cell(h.id) : NULL);
+    }
+
+    /* Get H's cell, without a bounds check. */
+    T &operator[](handle<T> h) { return *cell(h.id); }
+
+    /* Mark H as reachable. Only meaningful during collection, i.e.,
+     * from Hooks::trace. */
+    void mark(handle<T> h) {
+        if (oscar_mark_inline(p_, h.id)) work_.push_back(h.id);
+    }
+
+    /* Force a full collection. Returns <0 on error. */
+    int collect() { return oscar_force_gc(p_); }
+
+    size_t count() const { return p_->count; }
+
+    /* The underlying C pool. */
+    oscar *raw() { return p_; }
+
+    /* RAII root set: handles added to a scope are roots until it is
+     * destroyed. Scopes must be destroyed in the reverse order of
+     * their creation. */
+    class root_scope {
+    public:
+        explicit root_scope(pool &p) : p_(p), base_(p.roots_.size()) {}
+        ~root_scope() { p_.roots_.resize(base_); }
+
+        root_scope(const root_scope &) = delete;
+        root_scope &operator=(const root_scope &) = delete;
+
+        handle<T> add(handle<T> h) {
+            p_.roots_.push_back(h.id);
+            return h;
+        }
+
+    private:
+        pool &p_;
+        size_t base_;
+    };
+
+private:
+    oscar *p_;
+    std::vector<pool_id> roots_;    /* root_scope stack */
+    std::vector<pool_id> work_;     /* marked, but not yet traced */
+
+    T *cell(pool_id id) {
+        return reinterpret_cast<T *>(p_->raw + static_cast<size_t>(id) * cell_size);
+    }
+
+    static int mark_cb(oscar *, void *udata) {
+        pool &self = *static_cast<pool *>(udata);
+        try {
+            for (size_t i = 0; i < self.roots_.size(); i++) {
+                self.mark(handle<T>(self.roots_[i]));
+            }
+            while (!self.work_.empty()) {
+                pool_id id = self.work_.back();
+                self.work_.pop_back();
+                Hooks::trace(*self.cell(id), self);
+            }
+        } catch (...) {
+            self.work_.clear();
+            return -1;
+        }
+        return 0;
+    }
+
+    static void free_cb(oscar *p, pool_id id, void *) {
+        Hooks::finalize(*reinterpret_cast<T *>(p->raw +
+                static_cast<size_t>(id) * cell_size));
+    }
+};
+
+}
+
+#endif
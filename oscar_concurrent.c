@@ -0,0 +1,358 @@
+/* For copyright notice, see oscar.h. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "oscar.h"
+#include "oscar_inline.h"
+#include "oscar_internal.h"
+#include "oscar_concurrent.h"
+
+#if !defined(__GNUC__)
+#error "concurrent marking needs GCC-style __atomic builtins"
+#endif
+
+/* Mark bits are set by both threads while marking. */
+#define FETCH_OR(P, V) __atomic_fetch_or(P, V, __ATOMIC_RELAXED)
+#define LOAD(P) __atomic_load_n(P, __ATOMIC_ACQUIRE)
+#define STORE(P, V) __atomic_store_n(P, V, __ATOMIC_RELEASE)
+
+/* The mutator hands its gray cells to the collector in batches. */
+#define FLUSH_BATCH 256
+
+/* A growable stack of gray cells: marked, but not yet scanned. */
+typedef struct gray {
+    pool_id *ids;
+    size_t len;
+    size_t sz;
+} gray;
+
+struct oscar_concurrent {
+    oscar *pool;
+    oscar_scan_cb *scan_cb;     /* cell scanning callback */
+    void *scan_udata;           /* userdata for ^ */
+    pthread_t thread;           /* the collector */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        /* signalled when there is work or QUIT */
+    pthread_cond_t idle;        /* signalled when BUSY goes to 0 */
+
+    /* Under LOCK. */
+    gray queue;                 /* handed from the mutator to the collector */
+    int busy;                   /* is the collector (or QUEUE) non-idle?
+                                 * also read by the mutator without LOCK */
+    int quit;
+    int err;                    /* did scan_cb fail on the collector? */
+
+    /* Collector only. */
+    gray work;
+
+    /* Mutator only. */
+    int marking;                /* is a cycle marking? */
+    int remarking;              /* in the final remark pause? */
+    gray local;                 /* gray cells not yet handed over */
+    uint64_t *free_bits;        /* cells found dead by the last cycle, to
+                                 * allocate from while marking */
+    size_t free_words;
+    size_t free_next;           /* word to look in next */
+    pool_id swept_from;         /* cells in this range had already been */
+    pool_id swept_to;           /* swept when the cycle began */
+    oscar_concurrent_stats stats;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static int push(gray *g, pool_id id) {
+    if (g->len == g->sz) {
+        size_t nsz = (g->sz == 0 ? FLUSH_BATCH : 2 * g->sz);
+        pool_id *nids = realloc(g->ids, nsz * sizeof(pool_id));
+        if (nids == NULL) return -1;
+        g->ids = nids;
+        g->sz = nsz;
+    }
+    g->ids[g->len++] = id;
+    return 0;
+}
+
+/* Move the mutator's gray cells over to the collector, and wake it. */
+static int flush(struct oscar_concurrent *c) {
+    int res = 0;
+    size_t i = 0;
+    pthread_mutex_lock(&c->lock);
+    for (i = 0; i < c->local.len && res == 0; i++) {
+        res = push(&c->queue, c->local.ids[i]);
+    }
+    c->local.len = 0;
+    if (c->queue.len > 0) {
+        STORE(&c->busy, 1);
+        pthread_cond_signal(&c->wake);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return res;
+}
+
+static void *collector(void *udata) {
+    struct oscar_concurrent *c = (struct oscar_concurrent *) udata;
+    gray swap;
+    pthread_mutex_lock(&c->lock);
+    for (;;) {
+        while (c->queue.len == 0 && !c->quit) {
+            STORE(&c->busy, 0);
+            pthread_cond_broadcast(&c->idle);
+            pthread_cond_wait(&c->wake, &c->lock);
+        }
+        if (c->quit) break;
+
+        /* Take the whole queue, and trace from it without the lock. */
+        swap = c->work;
+        c->work = c->queue;
+        c->queue = swap;
+        c->queue.len = 0;
+        pthread_mutex_unlock(&c->lock);
+        while (c->work.len > 0) {
+            pool_id id = c->work.ids[--c->work.len];
+            if (c->scan_cb(c->pool, id, c->scan_udata) < 0) {
+                c->work.len = 0;
+                pthread_mutex_lock(&c->lock);
+                c->err = 1;
+                pthread_mutex_unlock(&c->lock);
+            }
+        }
+        pthread_mutex_lock(&c->lock);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+int oscar_concurrent_start(oscar *pool, oscar_scan_cb *scan_cb, void *udata) {
+    struct oscar_concurrent *c = NULL;
+#define FAIL(msg) { fprintf(stderr, msg "\n"); return -1; }
+    if (scan_cb == NULL) FAIL("NULL scan_cb");
+    if (pool->mem_cb == NULL) FAIL("concurrent marking needs a dynamic pool");
+    if (pool->concurrent) FAIL("already marking concurrently");
+    if (pool->flags & OSCAR_FLAG_EPOCH_MARKS)
+        FAIL("concurrent marking needs plain mark bits");
+    if (pool->flags & OSCAR_FLAG_READER) FAIL("can't mark a shared pool reader");
+#undef FAIL
+
+    c = calloc(1, sizeof(*c));
+    if (c == NULL) return -1;
+    c->pool = pool;
+    c->scan_cb = scan_cb;
+    c->scan_udata = udata;
+    c->busy = 1;                /* until the collector first waits */
+    if (pthread_mutex_init(&c->lock, NULL) != 0) goto fail_mutex;
+    if (pthread_cond_init(&c->wake, NULL) != 0) goto fail_wake;
+    if (pthread_cond_init(&c->idle, NULL) != 0) goto fail_idle;
+    if (pthread_create(&c->thread, NULL, collector, c) != 0) goto fail_thread;
+    pool->concurrent = c;
+    return 0;
+
+fail_thread:
+    pthread_cond_destroy(&c->idle);
+fail_idle:
+    pthread_cond_destroy(&c->wake);
+fail_wake:
+    pthread_mutex_destroy(&c->lock);
+fail_mutex:
+    free(c);
+    return -1;
+}
+
+int oscar_concurrent_mark(oscar *pool, pool_id id) {
+    struct oscar_concurrent *c = pool->concurrent;
+    uint64_t *word = NULL, bit = 0;
+    int on_collector = 0;
+    if (id >= pool->count) return 0;
+    word = &pool->markbits[id / 64];
+    bit = ((uint64_t) 1) << (id % 64);
+    if ((LOAD(word) & bit) || (FETCH_OR(word, bit) & bit)) return 0;
+
+    on_collector = pthread_equal(pthread_self(), c->thread);
+    if (on_collector) {
+        if (push(&c->work, id) < 0) {
+            pthread_mutex_lock(&c->lock);
+            c->err = 1;
+            pthread_mutex_unlock(&c->lock);
+        }
+    } else if (c->marking) {
+        if (push(&c->local, id) < 0
+            || (c->local.len >= FLUSH_BATCH && !c->remarking
+                && flush(c) < 0)) {
+            /* Out of memory: scan it now, on the mutator. */
+            (void) c->scan_cb(pool, id, c->scan_udata);
+        }
+    }
+    return 1;
+}
+
+void oscar_write_barrier(oscar *pool, pool_id old) {
+    struct oscar_concurrent *c = pool->concurrent;
+    if (c == NULL || !c->marking || old == OSCAR_ID_NONE) return;
+    oscar_concurrent_mark(pool, old);
+}
+
+int oscar_concurrent_marking(oscar *pool) {
+    return pool->concurrent != NULL && pool->concurrent->marking;
+}
+
+/* Note which cells from the lazy sweep onward are dead, so they can be
+ * allocated while the mark bits are in use by the new cycle. */
+static int save_free_cells(oscar *pool, struct oscar_concurrent *c) {
+    size_t words = (pool->count + 63) / 64, w = 0;
+    size_t first = pool->sweep / 64;
+    if (words > c->free_words) {
+        uint64_t *nb = realloc(c->free_bits, words * sizeof(uint64_t));
+        if (nb == NULL) return -1;
+        c->free_bits = nb;
+        c->free_words = words;
+    }
+    for (w = 0; w < words; w++) {
+        uint64_t live = pool->markbits[w];
+        if (pool->spanbits) live |= pool->spanbits[w];
+        c->free_bits[w] = (w < first ? 0 : ~live);
+    }
+    if (pool->sweep % 64 != 0) {
+        c->free_bits[first] &= ~((((uint64_t) 1) << (pool->sweep % 64)) - 1);
+    }
+    if (pool->count % 64 != 0) {
+        c->free_bits[words - 1] &= (((uint64_t) 1) << (pool->count % 64)) - 1;
+    }
+    c->free_next = first;
+    c->swept_from = pool->sweep;
+    c->swept_to = pool->preswept;
+    return 0;
+}
+
+int oscar_concurrent_begin(oscar *pool, int headroom) {
+    struct oscar_concurrent *c = pool->concurrent;
+    c->free_next = c->free_words; /* no headroom, unless saved below */
+    if (headroom && save_free_cells(pool, c) < 0) return -1;
+
+    oscar_begin_mark(pool);
+    c->marking = 1;
+    c->err = 0;
+    if (pool->mark_cb(pool, pool->mark_udata) < 0) {
+        (void) oscar_concurrent_finish(pool);
+        return -1;
+    }
+    return flush(c);
+}
+
+pool_id oscar_concurrent_alloc(oscar *pool) {
+    struct oscar_concurrent *c = pool->concurrent;
+    size_t w = c->free_next;
+    for (; w < c->free_words; w++) {
+        uint64_t bits = c->free_bits[w];
+        pool_id id = 0;
+        if (bits == 0) continue;
+        id = (pool_id) (w * 64 + (size_t) __builtin_ctzll(bits));
+        c->free_bits[w] = bits & (bits - 1);
+        c->free_next = w;
+        if (id < c->swept_from || id >= c->swept_to) oscar_sweep_cell(pool, id);
+        (void) FETCH_OR(&pool->markbits[w], ((uint64_t) 1) << (id % 64));
+        c->stats.black_allocs++;
+        if (pool->profile) oscar_profile_allocated(pool, id);
+        if (pool->trace) oscar_trace_allocated(pool, id, 1);
+        return id;
+    }
+    c->free_next = w;
+    return OSCAR_ID_NONE;
+}
+
+int oscar_concurrent_done(oscar *pool) {
+    return LOAD(&pool->concurrent->busy) == 0;
+}
+
+/* Scan the mutator's gray cells itself, during the remark. */
+static int drain_local(struct oscar_concurrent *c) {
+    while (c->local.len > 0) {
+        pool_id id = c->local.ids[--c->local.len];
+        if (c->scan_cb(c->pool, id, c->scan_udata) < 0) return -1;
+    }
+    return 0;
+}
+
+int oscar_concurrent_finish(oscar *pool) {
+    struct oscar_concurrent *c = pool->concurrent;
+    size_t w = 0, words = (pool->count + 63) / 64;
+    int res = 0, newly = 0;
+    uint64_t t0 = 0, pause = 0;
+    if (!c->marking) return 0;
+
+    /* Wait for the collector to run out of work. */
+    if (flush(c) < 0) res = -1;
+    pthread_mutex_lock(&c->lock);
+    if (c->busy) c->stats.waits++;
+    while (c->busy) pthread_cond_wait(&c->idle, &c->lock);
+    if (c->err) res = -1;
+    pthread_mutex_unlock(&c->lock);
+
+    /* Remark: the roots may have changed, and the mutator may have
+     * grayed more cells since its last flush. Then finish marking as
+     * oscar_collect would, tracing from ephemeron values as needed. */
+    t0 = now_ns();
+    c->remarking = 1;
+    if (res == 0 && pool->mark_cb(pool, pool->mark_udata) < 0) res = -1;
+    if (res == 0 && drain_local(c) < 0) res = -1;
+    while (res == 0 && (newly = oscar_mark_ephemerons(pool)) > 0) {
+        if (drain_local(c) < 0) res = -1;
+    }
+    if (newly < 0) res = -1;
+    if (res == 0) oscar_clear_weak(pool);
+    c->local.len = 0;
+    c->remarking = 0;
+    c->marking = 0;
+
+    pool->marked = 0;
+    for (w = 0; w < words; w++) {
+        pool->marked += (size_t) __builtin_popcountll(pool->markbits[w]);
+    }
+    pool->sweep = 0;
+    pool->preswept = 0;
+    c->stats.cycles++;
+    pause = now_ns() - t0;
+    if (pause > c->stats.max_remark_ns) c->stats.max_remark_ns = pause;
+    return res;
+}
+
+int oscar_concurrent_get_stats(oscar *pool, oscar_concurrent_stats *stats) {
+    if (pool->concurrent == NULL) return -1;
+    memcpy(stats, &pool->concurrent->stats, sizeof(*stats));
+    return 0;
+}
+
+int oscar_concurrent_stop(oscar *pool) {
+    int res = 0;
+    if (pool->concurrent == NULL) return 0;
+    res = oscar_concurrent_finish(pool);
+    oscar_concurrent_abandon(pool);
+    return res;
+}
+
+void oscar_concurrent_abandon(oscar *pool) {
+    struct oscar_concurrent *c = pool->concurrent;
+    if (c == NULL) return;
+    pthread_mutex_lock(&c->lock);
+    c->quit = 1;
+    pthread_cond_signal(&c->wake);
+    pthread_mutex_unlock(&c->lock);
+    pthread_join(c->thread, NULL);
+
+    pthread_cond_destroy(&c->idle);
+    pthread_cond_destroy(&c->wake);
+    pthread_mutex_destroy(&c->lock);
+    free(c->queue.ids);
+    free(c->work.ids);
+    free(c->local.ids);
+    free(c->free_bits);
+    free(c);
+    pool->concurrent = NULL;
+}
@@ -0,0 +1,79 @@
+/* For copyright notice, see oscar.h. */
+
+#ifndef OSCAR_CONCURRENT_H
+#define OSCAR_CONCURRENT_H
+
+/* Optional concurrent marking. A collector thread traces the pool while
+ * the mutator (the one thread using the pool) keeps allocating and
+ * updating cells, so a collection only pauses the mutator twice: once
+ * to mark the roots at the start, and once for a final remark.
+ *
+ * Marking is snapshot-at-the-beginning: every cell reachable when the
+ * cycle starts is kept. The mutator has to help by calling
+ * oscar_write_barrier on the old value of any reference in a cell it
+ * is about to overwrite. Cells allocated while marking are marked at
+ * once ("allocated black"), and come from cells the previous cycle
+ * found dead, so the lazy sweep doesn't race the collector.
+ *
+ * A cycle starts once the lazy sweep is halfway through the pool. When
+ * the collector is done, the next oscar_alloc remarks and restarts the
+ * lazy sweep; if the mutator runs out of free cells first, it waits.
+ * Spans, scopes, and explicit collections all finish any cycle first. */
+
+#include "oscar.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Callback to mark what cell ID refers to, using oscar_mark (or
+ * oscar_concurrent_mark) on each reference. It runs on the collector
+ * thread, while the mutator may be writing to the cell, so it should
+ * read each reference once, and not otherwise touch the pool. Should
+ * return <0 on error. */
+typedef int (oscar_scan_cb)(oscar *pool, pool_id id, void *udata);
+
+/* Statistics about concurrent marking, from oscar_concurrent_get_stats. */
+typedef struct oscar_concurrent_stats {
+    size_t cycles;              /* concurrent cycles finished */
+    size_t black_allocs;        /* cells allocated while marking */
+    size_t waits;               /* times the mutator ran out of cells
+                                 * and waited for the collector */
+    uint64_t max_remark_ns;     /* longest final remark pause */
+} oscar_concurrent_stats;
+
+/* Start marking POOL concurrently, on a new collector thread. From now
+ * on, mark_cb should only mark the roots: the collector calls SCAN_CB
+ * on every newly marked cell to trace the rest. (A mark_cb that traces
+ * everything itself still works, just without the concurrency.) Only
+ * for dynamic pools outside of pool groups. Returns <0 on error. */
+int oscar_concurrent_start(oscar *pool, oscar_scan_cb *scan_cb, void *udata);
+
+/* Call before overwriting a reference to OLD in one of POOL's cells.
+ * While a cycle is marking, this keeps OLD alive; otherwise, it does
+ * nothing. */
+void oscar_write_barrier(oscar *pool, pool_id old);
+
+/* Mark cell ID of a pool marking concurrently, from mark_cb or
+ * scan_cb: like oscar_mark_inline, which isn't safe here, this returns
+ * nonzero if it was newly marked. The mark bit is set atomically, and
+ * the cell queued to be scanned. */
+int oscar_concurrent_mark(oscar *pool, pool_id id);
+
+/* Is a concurrent cycle marking now? */
+int oscar_concurrent_marking(oscar *pool);
+
+/* Get POOL's concurrent marking statistics. Returns <0 if it isn't
+ * marking concurrently. */
+int oscar_concurrent_get_stats(oscar *pool, oscar_concurrent_stats *stats);
+
+/* Finish any cycle in progress, and stop the collector thread, so
+ * POOL goes back to collecting on the mutator's thread. Returns <0 if
+ * the last cycle failed. */
+int oscar_concurrent_stop(oscar *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,144 @@
+/* For copyright notice, see oscar.h. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "oscar.h"
+#include "oscar_inline.h"
+#include "oscar_internal.h"
+#include "oscar_group.h"
+
+#define TAG_SHIFT (8 * sizeof(pool_id) - OSCAR_GROUP_TAG_BITS)
+#define LOCAL_MASK ((((pool_id) 1) << TAG_SHIFT) - 1)
+#define TAG_OF(ID) ((unsigned int) ((ID) >> TAG_SHIFT))
+#define LOCAL_ID(ID) ((ID) & LOCAL_MASK)
+
+struct oscar_group {
+    unsigned int pool_count;    /* number of pools */
+    oscar *pools[OSCAR_GROUP_MAX_POOLS];
+    oscar_memory_cb *mem_cb;    /* memory callback */
+    void *mem_udata;            /* userdata for ^ */
+    oscar_group_mark_cb *mark_cb; /* marking callback */
+    void *mark_udata;           /* userdata for ^ */
+};
+
+/* Restart marking in every pool but SKIP (whose caller already has),
+ * and run the group's mark_cb once. */
+static int mark_group(oscar_group *group, oscar *skip) {
+    unsigned int i = 0;
+    int newly = 0;
+    for (i = 0; i < group->pool_count; i++) {
+        if (group->pools[i] != skip) oscar_begin_mark(group->pools[i]);
+    }
+    if (group->mark_cb(group, group->mark_udata) < 0) return -1;
+
+    /* An ephemeron value in one pool can reach keys in another, so go
+     * around them all until none reach anything new. */
+    do {
+        newly = 0;
+        for (i = 0; i < group->pool_count; i++) {
+            int res = oscar_mark_ephemerons(group->pools[i]);
+            if (res < 0) return -1;
+            newly += res;
+        }
+    } while (newly > 0);
+    for (i = 0; i < group->pool_count; i++) {
+        oscar_clear_weak(group->pools[i]);
+    }
+    return 0;
+}
+
+/* Mark callback for every pool: whichever pool needs to collect, mark
+ * the whole group, then finish collecting in the other pools as if
+ * each had collected by itself. (POOL's own collection is finished by
+ * its caller.) If another pool can't grow, that doesn't stop POOL from
+ * allocating; it will try again when it next fills up. */
+static int mark_all_pools(oscar *pool, void *udata) {
+    oscar_group *group = (oscar_group *) udata;
+    unsigned int i = 0;
+    if (mark_group(group, pool) < 0) return -1;
+    for (i = 0; i < group->pool_count; i++) {
+        if (group->pools[i] != pool) (void) oscar_end_collect(group->pools[i]);
+    }
+    return 0;
+}
+
+oscar_group *oscar_group_new(oscar_memory_cb *mem_cb, void *mem_udata,
+                             oscar_group_mark_cb *mark_cb, void *mark_udata) {
+    oscar_group *group = NULL;
+#define FAIL(msg) { fprintf(stderr, msg "\n"); return NULL; }
+    if (mark_cb == NULL) FAIL("NULL mark_cb");
+    if (mem_cb == NULL) FAIL("NULL mem_cb");
+#undef FAIL
+
+    group = mem_cb(NULL, 0, sizeof(*group), mem_udata);
+    if (group == NULL) return NULL;
+    memset(group, 0, sizeof(*group));
+    group->mem_cb = mem_cb;
+    group->mem_udata = mem_udata;
+    group->mark_cb = mark_cb;
+    group->mark_udata = mark_udata;
+    return group;
+}
+
+int oscar_group_add(oscar_group *group, oscar *pool) {
+    if (group->pool_count == OSCAR_GROUP_MAX_POOLS) return -1;
+    if (pool->mem_cb == NULL || pool->concurrent
+        || (pool->flags & OSCAR_FLAG_READER)) {
+        return -1;
+    }
+    if (oscar_set_max_count(pool, (size_t) LOCAL_MASK) < 0) return -1;
+    pool->mark_cb = mark_all_pools;
+    pool->mark_udata = group;
+    group->pools[group->pool_count] = pool;
+    return (int) group->pool_count++;
+}
+
+oscar *oscar_group_pool(oscar_group *group, unsigned int tag) {
+    return (tag < group->pool_count ? group->pools[tag] : NULL);
+}
+
+pool_id oscar_group_id(unsigned int tag, pool_id id) {
+    return (((pool_id) tag) << TAG_SHIFT) | id;
+}
+
+unsigned int oscar_group_tag(pool_id id) { return TAG_OF(id); }
+
+pool_id oscar_group_alloc(oscar_group *group, unsigned int tag) {
+    pool_id id = OSCAR_ID_NONE;
+    if (tag >= group->pool_count) return OSCAR_ID_NONE;
+    id = oscar_alloc(group->pools[tag]);
+    if (id == OSCAR_ID_NONE) return OSCAR_ID_NONE;
+    return oscar_group_id(tag, id);
+}
+
+void *oscar_group_get(oscar_group *group, pool_id id) {
+    unsigned int tag = TAG_OF(id);
+    if (tag >= group->pool_count) return NULL;
+    return oscar_get_inline(group->pools[tag], LOCAL_ID(id));
+}
+
+void oscar_group_mark(oscar_group *group, pool_id id) {
+    unsigned int tag = TAG_OF(id);
+    if (tag >= group->pool_count) return;
+    (void) oscar_mark_inline(group->pools[tag], LOCAL_ID(id));
+}
+
+int oscar_group_force_gc(oscar_group *group) {
+    unsigned int i = 0;
+    if (mark_group(group, NULL) < 0) return -1;
+    for (i = 0; i < group->pool_count; i++) {
+        oscar_end_force_gc(group->pools[i]);
+    }
+    return 0;
+}
+
+void oscar_group_free(oscar_group *group) {
+    unsigned int i = 0;
+    for (i = 0; i < group->pool_count; i++) {
+        oscar_free(group->pools[i]);
+    }
+    group->mem_cb(group, sizeof(*group), 0, group->mem_udata);
+}
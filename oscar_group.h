@@ -0,0 +1,82 @@
+/* For copyright notice, see oscar.h. */
+
+#ifndef OSCAR_GROUP_H
+#define OSCAR_GROUP_H
+
+#include "oscar.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A group of pools that collect together. Cells in any pool of the
+ * group can refer to cells in any other by group ID: the top
+ * OSCAR_GROUP_TAG_BITS bits of a group ID say which pool it's in, and
+ * the rest are the ID within that pool.
+ *
+ * The group has one mark callback for the whole root set. Whenever any
+ * of its pools needs to collect, marking restarts in every pool and the
+ * callback runs once, so the graph is only traversed once however many
+ * pools it spans. Each pool keeps its own cells, growth and sweeping,
+ * and finishes every collection as if it had collected by itself, so
+ * allocating in one pool may grow another (moving its cells) or call
+ * its watermark callback. */
+
+/* Opaque struct for the group. */
+typedef struct oscar_group oscar_group;
+
+/* Bits of a group ID used for the pool's tag. The remaining bits
+ * limit how many cells each pool can hold. */
+#define OSCAR_GROUP_TAG_BITS 4
+
+/* Maximum number of pools in a group. (The last possible tag is left
+ * unused, so no group ID is ever OSCAR_ID_NONE.) */
+#define OSCAR_GROUP_MAX_POOLS ((1 << OSCAR_GROUP_TAG_BITS) - 1)
+
+/* Function to mark the group's root set, using oscar_group_mark on
+ * each reachable group ID. Should return <0 on error. */
+typedef int (oscar_group_mark_cb)(oscar_group *group, void *udata);
+
+/* Init an empty group. Returns NULL on error. */
+oscar_group *oscar_group_new(oscar_memory_cb *mem_cb, void *mem_udata,
+    oscar_group_mark_cb *mark_cb, void *mark_udata);
+
+/* Add a dynamic POOL to the group, which takes it over: the pool's own
+ * mark callback is replaced, its cell count is limited so every ID fits
+ * in a group ID, and it is freed along with the group. Its free_cb is
+ * kept, and still gets IDs within the pool (see oscar_group_id), as do
+ * its weak refs and ephemerons, which the group clears together.
+ * Returns the pool's tag, or <0 on error. */
+int oscar_group_add(oscar_group *group, oscar *pool);
+
+/* Get the pool with tag TAG, or NULL if there isn't one. */
+oscar *oscar_group_pool(oscar_group *group, unsigned int tag);
+
+/* Get the group ID for the ID'th cell of the pool with tag TAG. */
+pool_id oscar_group_id(unsigned int tag, pool_id id);
+
+/* Get the tag of the pool a group ID is in. */
+unsigned int oscar_group_tag(pool_id id);
+
+/* Get a fresh group ID from the pool with tag TAG. As with oscar_alloc,
+ * this can cause a mark/sweep pass (of the whole group), and may move
+ * that pool's cells in memory. Returns OSCAR_ID_NONE on error. */
+pool_id oscar_group_alloc(oscar_group *group, unsigned int tag);
+
+/* Get a pointer to a cell, by group ID. Returns NULL on error. */
+void *oscar_group_get(oscar_group *group, pool_id id);
+
+/* Mark a group ID's cell as reachable. */
+void oscar_group_mark(oscar_group *group, pool_id id);
+
+/* Force a full GC mark/sweep of every pool. Returns <0 on error. */
+int oscar_group_force_gc(oscar_group *group);
+
+/* Free the group and all of its pools. */
+void oscar_group_free(oscar_group *group);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
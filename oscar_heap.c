@@ -0,0 +1,138 @@
+/* For copyright notice, see oscar.h. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "oscar.h"
+#include "oscar_inline.h"
+#include "oscar_group.h"
+#include "oscar_heap.h"
+
+/* Default size classes, in bytes. */
+static const size_t default_sizes[] = { 16, 32, 64, 128, 256, 512, 1024 };
+
+typedef struct size_class {
+    oscar_heap *heap;           /* heap containing this class */
+    unsigned int index;         /* class number, i.e. group tag */
+} size_class;
+
+struct oscar_heap {
+    oscar_group *group;         /* one pool per size class */
+    unsigned int class_count;   /* number of size classes */
+    size_class classes[OSCAR_HEAP_MAX_CLASSES];
+    oscar_memory_cb *mem_cb;    /* memory callback */
+    void *mem_udata;            /* userdata for ^ */
+    oscar_heap_mark_cb *mark_cb; /* marking callback */
+    void *mark_udata;           /* userdata for ^ */
+    oscar_heap_free_cb *free_cb; /* free callback */
+    void *free_udata;           /* userdata for ^ */
+};
+
+/* Group mark callback, calling the user's with the heap. */
+static int mark_heap(oscar_group *group, void *udata) {
+    oscar_heap *heap = (oscar_heap *) udata;
+    return heap->mark_cb(heap, heap->mark_udata);
+}
+
+/* Placeholder mark callback for each class's pool, until the group
+ * takes it over. */
+static int mark_nothing(oscar *pool, void *udata) { return 0; }
+
+/* Free callback for every class, translating to heap IDs. */
+static void free_class_cell(oscar *pool, pool_id id, void *udata) {
+    size_class *sc = (size_class *) udata;
+    oscar_heap *heap = sc->heap;
+    heap->free_cb(heap, oscar_group_id(sc->index, id), heap->free_udata);
+}
+
+oscar_heap *oscar_heap_new(const size_t *class_sizes, unsigned int class_count,
+                           size_t start_count,
+                           oscar_memory_cb *mem_cb, void *mem_udata,
+                           oscar_heap_mark_cb *mark_cb, void *mark_udata,
+                           oscar_heap_free_cb *free_cb, void *free_udata) {
+    oscar_heap *heap = NULL;
+    unsigned int i = 0;
+
+#define FAIL(msg) { fprintf(stderr, msg "\n"); return NULL; }
+    if (class_sizes == NULL) {
+        class_sizes = default_sizes;
+        class_count = sizeof(default_sizes) / sizeof(default_sizes[0]);
+    }
+    if (class_count < 1 || class_count > OSCAR_HEAP_MAX_CLASSES)
+        FAIL("bad class count");
+    for (i = 1; i < class_count; i++) {
+        if (class_sizes[i] <= class_sizes[i - 1])
+            FAIL("class sizes must be increasing");
+    }
+    if (mark_cb == NULL) FAIL("NULL mark_cb");
+    if (mem_cb == NULL) FAIL("NULL mem_cb");
+#undef FAIL
+
+    heap = mem_cb(NULL, 0, sizeof(*heap), mem_udata);
+    if (heap == NULL) return NULL;
+    memset(heap, 0, sizeof(*heap));
+    heap->class_count = class_count;
+    heap->mem_cb = mem_cb;
+    heap->mem_udata = mem_udata;
+    heap->mark_cb = mark_cb;
+    heap->mark_udata = mark_udata;
+    heap->free_cb = free_cb;
+    heap->free_udata = free_udata;
+
+    heap->group = oscar_group_new(mem_cb, mem_udata, mark_heap, heap);
+    if (heap->group == NULL) goto cleanup;
+    for (i = 0; i < class_count; i++) {
+        size_class *sc = &heap->classes[i];
+        oscar *pool = NULL;
+        sc->heap = heap;
+        sc->index = i;
+        pool = oscar_new(class_sizes[i], start_count, mem_cb, mem_udata,
+            mark_nothing, NULL, free_cb ? free_class_cell : NULL, sc);
+        if (pool == NULL) goto cleanup;
+        if (oscar_group_add(heap->group, pool) != (int) i) {
+            oscar_free(pool);
+            goto cleanup;
+        }
+    }
+    return heap;
+
+cleanup:
+    if (heap->group) oscar_group_free(heap->group);
+    mem_cb(heap, sizeof(*heap), 0, mem_udata);
+    return NULL;
+}
+
+pool_id oscar_heap_alloc(oscar_heap *heap, size_t sz) {
+    unsigned int i = 0;
+    for (i = 0; i < heap->class_count; i++) {
+        if (sz <= oscar_group_pool(heap->group, i)->cell_sz) {
+            return oscar_group_alloc(heap->group, i);
+        }
+    }
+    return OSCAR_ID_NONE;
+}
+
+void *oscar_heap_get(oscar_heap *heap, pool_id id) {
+    return oscar_group_get(heap->group, id);
+}
+
+size_t oscar_heap_cell_size(oscar_heap *heap, pool_id id) {
+    oscar *pool = oscar_group_pool(heap->group, oscar_group_tag(id));
+    if (pool == NULL || oscar_group_get(heap->group, id) == NULL) return 0;
+    return pool->cell_sz;
+}
+
+void oscar_heap_mark(oscar_heap *heap, pool_id id) {
+    oscar_group_mark(heap->group, id);
+}
+
+int oscar_heap_force_gc(oscar_heap *heap) {
+    return oscar_group_force_gc(heap->group);
+}
+
+void oscar_heap_free(oscar_heap *heap) {
+    oscar_group_free(heap->group);
+    heap->mem_cb(heap, sizeof(*heap), 0, heap->mem_udata);
+}
@@ -0,0 +1,76 @@
+/* For copyright notice, see oscar.h. */
+
+#ifndef OSCAR_HEAP_H
+#define OSCAR_HEAP_H
+
+#include "oscar.h"
+#include "oscar_group.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A heap of variable-sized objects, built from a group of oscar pools
+ * with increasing cell sizes ("size classes"). Allocations are routed
+ * to the smallest class that fits. Every class shares one ID space:
+ * a heap ID is a group ID (see oscar_group.h) whose tag is its class,
+ * so a cell in one class can refer to cells in any other.
+ *
+ * All classes are marked together by a single mark callback. When
+ * any class runs out of cells, every class is re-marked in the same
+ * pass, so cross-class references only need to be traced once. Each
+ * class still grows and sweeps on its own. */
+
+/* Opaque struct for the heap. */
+typedef struct oscar_heap oscar_heap;
+
+/* Bits of a heap ID used for the size class. The remaining bits
+ * limit how many cells each class can hold. */
+#define OSCAR_HEAP_CLASS_BITS OSCAR_GROUP_TAG_BITS
+
+/* Maximum number of size classes. */
+#define OSCAR_HEAP_MAX_CLASSES OSCAR_GROUP_MAX_POOLS
+
+/* Function to mark the heap's root set, using oscar_heap_mark on each
+ * reachable heap ID. Should return <0 on error. */
+typedef int (oscar_heap_mark_cb)(oscar_heap *heap, void *udata);
+
+/* If non-NULL, called whenever an unreachable cell is about to be swept,
+ * as with oscar_free_cb. */
+typedef void (oscar_heap_free_cb)(oscar_heap *heap, pool_id id, void *udata);
+
+/* Init a heap with CLASS_COUNT size classes, whose cell sizes (in
+ * increasing order) are in CLASS_SIZES. If CLASS_SIZES is NULL, use
+ * the default classes of 16, 32, 64, ..., 1024 bytes. Each class starts
+ * with START_COUNT cells. Returns NULL on error. */
+oscar_heap *oscar_heap_new(const size_t *class_sizes, unsigned int class_count,
+    size_t start_count,
+    oscar_memory_cb *mem_cb, void *mem_udata,
+    oscar_heap_mark_cb *mark_cb, void *mark_udata,
+    oscar_heap_free_cb *free_cb, void *free_udata);
+
+/* Get a fresh heap ID for an object of SZ bytes. As with oscar_alloc,
+ * this can cause a mark/sweep pass, and may move cells in memory.
+ * Returns OSCAR_ID_NONE on error, or if SZ is larger than every class. */
+pool_id oscar_heap_alloc(oscar_heap *heap, size_t sz);
+
+/* Get a pointer to a cell, by heap ID. Returns NULL on error. */
+void *oscar_heap_get(oscar_heap *heap, pool_id id);
+
+/* Get the size of the cell for a heap ID, or 0 on error. */
+size_t oscar_heap_cell_size(oscar_heap *heap, pool_id id);
+
+/* Mark a heap ID's cell as reachable. */
+void oscar_heap_mark(oscar_heap *heap, pool_id id);
+
+/* Force a full GC mark/sweep of every class. Returns <0 on error. */
+int oscar_heap_force_gc(oscar_heap *heap);
+
+/* Free the heap and all of its classes. */
+void oscar_heap_free(oscar_heap *heap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,128 @@
+/* For copyright notice, see oscar.h. */
+
+#ifndef OSCAR_INLINE_H
+#define OSCAR_INLINE_H
+
+/* Optional header exposing oscar's internals, so that oscar_get and
+ * oscar_mark can be inlined into hot loops. Code using it must be
+ * rebuilt whenever oscar is, since the struct layout is not part of
+ * the stable ABI; the out-of-line functions in oscar.h remain
+ * available either way. */
+
+#include "oscar.h"
+
+#if defined(__cplusplus) || \
+    (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L)
+#define OSCAR_INLINE static inline
+#elif defined(__GNUC__)
+#define OSCAR_INLINE static __inline__
+#else
+#define OSCAR_INLINE static
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Flags for struct oscar. */
+#define OSCAR_FLAG_MAPPED_CELLS 0x01 /* RAW_BASE is a file/shared mapping */
+#define OSCAR_FLAG_ABOVE_WATERMARK 0x02 /* last collection reached it */
+#define OSCAR_FLAG_EPOCH_MARKS 0x04 /* flip MARK_FLIP, not clear MARKBITS */
+#define OSCAR_FLAG_READER 0x08 /* read-only view; can't alloc or collect */
+
+struct oscar {
+    size_t cell_sz;             /* each cell is CELL_SZ bytes */
+    size_t cell_align;          /* cells are aligned to CELL_ALIGN bytes */
+    size_t count;               /* number of cells */
+    size_t max_count;           /* limit on COUNT when growing */
+    size_t marked;              /* how many were marked */
+    size_t sz;                  /* size of RAW_BASE, in bytes */
+    size_t markbits_sz;         /* size of MARKBITS_BASE, in bytes */
+    size_t grow_step;           /* if nonzero, grow RAW in multiples of this */
+    size_t huge_bytes;          /* bytes mapped with huge page advice,
+                                 * while THP was enabled */
+    pool_id sweep;              /* lazy sweep index */
+    pool_id preswept;           /* cells from SWEEP up to here were already
+                                 * swept by oscar_sweep_step */
+    unsigned int flags;         /* OSCAR_FLAG_* */
+    oscar_memory_cb *mem_cb;    /* memory callback */
+    void *mem_udata;            /* userdata for ^ */
+    oscar_mark_cb *mark_cb;     /* marking callback */
+    void *mark_udata;           /* userdata for ^ */
+    oscar_free_cb *free_cb;     /* free callback */
+    void *free_udata;           /* userdata for ^ */
+    char *raw;                  /* raw memory for storage, COUNT cells */
+    char *raw_base;             /* allocation containing RAW */
+    uint64_t *markbits;         /* mark bit array, one bit per cell */
+    uint64_t mark_flip;         /* XORed with MARKBITS to get the marks:
+                                 * 0, or ~0 every other epoch cycle */
+    char *markbits_base;        /* allocation containing MARKBITS */
+    uint64_t *spanbits;         /* set for cells continuing a span, or
+                                 * NULL until the first oscar_alloc_span */
+    char *spanbits_base;        /* allocation containing SPANBITS */
+    size_t spanbits_sz;         /* size of SPANBITS_BASE, in bytes */
+    uint64_t *escapebits;       /* set for cells escaping their scope, or
+                                 * NULL until the first oscar_scope_begin */
+    char *escapebits_base;      /* allocation containing ESCAPEBITS */
+    size_t escapebits_sz;       /* size of ESCAPEBITS_BASE, in bytes */
+    oscar_scope *scopes;        /* innermost open scope, or NULL */
+    size_t cycles;              /* collections so far */
+    struct oscar_profile *profile; /* lifetime profiler, or NULL */
+    struct oscar_trace *trace;  /* trace recorder, or NULL */
+    oscar_weak_ref *weak_refs;  /* registered weak refs, or NULL */
+    oscar_ephemeron *ephemerons; /* registered ephemerons, or NULL */
+    oscar_ephemeron_cb *ephemeron_cb; /* ephemeron value callback */
+    void *ephemeron_udata;      /* userdata for ^ */
+    struct oscar_concurrent *concurrent; /* concurrent marking, or NULL */
+    size_t raw_count;           /* cells in RAW; less than COUNT only
+                                 * while a fixed pool spills into OVERFLOW */
+    size_t overflow_max;        /* limit on overflow cells, 0 if disabled */
+    char *overflow;             /* overflow cells, or NULL */
+    size_t overflow_sz;         /* size of OVERFLOW, in bytes */
+    oscar_memory_cb *overflow_cb; /* memory callback for the overflow */
+    void *overflow_udata;       /* userdata for ^ */
+    size_t watermark;           /* live cells that trigger WATERMARK_CB */
+    oscar_watermark_cb *watermark_cb; /* watermark callback, or NULL */
+    void *watermark_udata;      /* userdata for ^ */
+};
+
+/* Get a pointer to the ID'th cell, without checking that ID is in
+ * the pool. Only for trusted IDs below RAW_COUNT, such as while walking
+ * a dynamic pool's 0..count-1; a fixed pool's overflow cells (see
+ * oscar_set_overflow) need oscar_get. */
+OSCAR_INLINE void *oscar_get_unchecked(oscar *pool, pool_id id) {
+    return pool->raw + (id * pool->cell_sz);
+}
+
+/* Inline version of oscar_get. Returns NULL on error. Cells in a fixed
+ * pool's overflow are looked up out of line. */
+OSCAR_INLINE void *oscar_get_inline(oscar *pool, pool_id id) {
+    if (id < pool->raw_count) return oscar_get_unchecked(pool, id);
+    return oscar_get(pool, id);
+}
+
+/* Mark the ID'th cell as reachable, without checking that ID is in
+ * the pool. Returns nonzero if it was not already marked, so marking
+ * code can skip tracing cells it has already visited. Not for a pool
+ * marking concurrently, whose collector thread sets mark bits too: its
+ * callbacks mark with oscar_mark or oscar_concurrent_mark instead. */
+OSCAR_INLINE int oscar_mark_unchecked(oscar *pool, pool_id id) {
+    uint64_t *word = &pool->markbits[id / 64];
+    uint64_t bit = ((uint64_t) 1) << (id % 64);
+    if ((*word ^ pool->mark_flip) & bit) return 0;
+    *word ^= bit;
+    pool->marked++;
+    return 1;
+}
+
+/* Inline version of oscar_mark. Returns nonzero if the cell was
+ * newly marked, 0 if it was already marked or ID is out of range. */
+OSCAR_INLINE int oscar_mark_inline(oscar *pool, pool_id id) {
+    return (id < pool->count ? oscar_mark_unchecked(pool, id) : 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,95 @@
+/* For copyright notice, see oscar.h. */
+
+#ifndef OSCAR_INTERNAL_H
+#define OSCAR_INTERNAL_H
+
+/* Private hooks between oscar.c and the optional modules (oscar_*.c).
+ * Not installed, and not for code using oscar. */
+
+#include "oscar_inline.h"
+
+/* Init a dynamic pool around COUNT existing CELL_SZ-byte cells at RAW,
+ * which must be CELL_ALIGN-aligned. As far as MEM_CB is concerned, RAW
+ * is an allocation of RAW_SZ bytes, which the pool now owns. Only the
+ * pool struct and (zeroed) mark bits are allocated. Returns NULL on
+ * error, in which case RAW is left alone. */
+oscar *oscar_new_with_cells(size_t cell_sz, size_t cell_align, size_t count,
+    char *raw, size_t raw_sz,
+    oscar_memory_cb *mem_cb, void *mem_udata,
+    oscar_mark_cb *mark_cb, void *mark_udata,
+    oscar_free_cb *free_cb, void *free_udata);
+
+/* Move a dynamic POOL onto COUNT cells at RAW, an allocation of RAW_SZ
+ * bytes (as far as mem_cb is concerned) holding the current cells
+ * followed by any new ones, and grow the mark bits to match. The old
+ * cells are neither copied nor freed; that is up to the caller. COUNT
+ * must not be less than the current count. Returns <0 on error. */
+int oscar_set_cells(oscar *pool, char *raw, size_t raw_sz, size_t count);
+
+/* Hooks for the lifetime profiler (oscar_profile.h), called when
+ * POOL->PROFILE is set and ID is handed out, once a collection is done
+ * marking (to record the deaths of samples it found unmarked), or when
+ * ID is released by its scope, without a collection finding it dead. */
+void oscar_profile_allocated(oscar *pool, pool_id id);
+void oscar_profile_collected(oscar *pool);
+void oscar_profile_swept(oscar *pool, pool_id id);
+
+/* Hook for shared pools (oscar_mmap.h), called when a pool with
+ * OSCAR_FLAG_MAPPED_CELLS is about to release cells for reuse outside
+ * of a collection: a shared writer starts a new generation. */
+void oscar_shared_released(oscar *pool);
+
+/* Is ID in the pool and marked? */
+int oscar_is_marked(oscar *pool, pool_id id);
+
+/* Hooks for the trace recorder (oscar_trace.h), called when POOL->TRACE
+ * is set and ID is handed out (as a span of CELLS cells) or found
+ * marked once marking is done, or a collection begins or is DONE. */
+void oscar_trace_allocated(oscar *pool, pool_id id, size_t cells);
+void oscar_trace_marked(oscar *pool, pool_id id);
+void oscar_trace_gc(oscar *pool, int done);
+
+/* Clear POOL's mark bits and restart its lazy sweep, so it can be
+ * marked as part of a collection driven from outside the pool. */
+void oscar_begin_mark(oscar *pool);
+
+/* Once such a collection is done marking, finish it as oscar_collect
+ * would (growing POOL if mostly live, restarting the lazy sweep, and
+ * checking the watermark), or as oscar_force_gc would, sweeping every
+ * dead cell now. oscar_end_collect returns <0 if growth failed. */
+int oscar_end_collect(oscar *pool);
+void oscar_end_force_gc(oscar *pool);
+
+/* After mark_cb, mark the values of POOL's ephemerons whose keys are
+ * marked (calling the ephemeron callback on each). Returns how many
+ * were newly marked, so callers can repeat until none are, or <0 on
+ * error. */
+int oscar_mark_ephemerons(oscar *pool);
+
+/* Once marking is done, clear POOL's weak refs and ephemerons whose
+ * targets or keys weren't marked. */
+void oscar_clear_weak(oscar *pool);
+
+/* Hooks for concurrent marking (oscar_concurrent.h), when
+ * POOL->CONCURRENT is set. oscar_concurrent_begin starts a cycle
+ * and marks the roots, saving the cells the lazy sweep has yet to find
+ * dead as HEADROOM for oscar_concurrent_alloc, which hands them out
+ * marked (or OSCAR_ID_NONE once they run out). oscar_concurrent_done
+ * checks whether the collector is idle, and oscar_concurrent_finish
+ * waits for it, remarks, and restarts the lazy sweep; both begin and
+ * finish return <0 on error. oscar_concurrent_abandon stops the
+ * collector without finishing. */
+int oscar_concurrent_begin(oscar *pool, int headroom);
+pool_id oscar_concurrent_alloc(oscar *pool);
+int oscar_concurrent_done(oscar *pool);
+int oscar_concurrent_finish(oscar *pool);
+void oscar_concurrent_abandon(oscar *pool);
+
+/* Sweep the unmarked cell ID now: call free_cb on it and zero it. */
+void oscar_sweep_cell(oscar *pool, pool_id id);
+
+/* Eagerly sweep every cell left unmarked, calling free_cb on each.
+ * Mark bits are kept, so the lazy sweep skips the live cells. */
+void oscar_sweep_all(oscar *pool);
+
+#endif
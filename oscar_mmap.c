@@ -0,0 +1,600 @@
+/* For copyright notice, see oscar.h. */
+
+#define _GNU_SOURCE             /* for MAP_ANONYMOUS, madvise, memfd_create */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "oscar.h"
+#include "oscar_inline.h"
+#include "oscar_internal.h"
+#include "oscar_mmap.h"
+#include "oscar_concurrent.h"
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* Round N up to a whole number of huge pages, or 0 on overflow. */
+static size_t round_huge(size_t n) {
+    if (n > SIZE_MAX - (OSCAR_HUGE_PAGE - 1)) return 0;
+    return (n + OSCAR_HUGE_PAGE - 1) & ~(OSCAR_HUGE_PAGE - 1);
+}
+
+/* Are transparent huge pages enabled, at least for advised ranges?
+ * madvise(MADV_HUGEPAGE) succeeds even when they are set to "never". */
+static int thp_enabled(void) {
+    char buf[128];
+    size_t n = 0;
+    FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (f == NULL) return 0;
+    n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    return (strstr(buf, "[always]") != NULL
+        || strstr(buf, "[madvise]") != NULL);
+}
+
+/* Map SZ bytes (a multiple of OSCAR_HUGE_PAGE) on a huge page boundary,
+ * and ask for huge pages. ADVISED counts the bytes where that can
+ * work. Returns NULL on failure. */
+static void *map_huge(size_t sz, size_t *advised) {
+    char *p = NULL, *aligned = NULL;
+    size_t head = 0, tail = 0;
+    if (sz > SIZE_MAX - OSCAR_HUGE_PAGE) return NULL;
+
+    /* Over-map by a huge page, then trim to an aligned range. */
+    p = mmap(NULL, sz + OSCAR_HUGE_PAGE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    aligned = (char *) (((uintptr_t) p + OSCAR_HUGE_PAGE - 1)
+        & ~((uintptr_t) OSCAR_HUGE_PAGE - 1));
+    head = aligned - p;
+    tail = OSCAR_HUGE_PAGE - head;
+    if (head > 0) munmap(p, head);
+    if (tail > 0) munmap(aligned + sz, tail);
+
+#ifdef MADV_HUGEPAGE
+    if (madvise(aligned, sz, MADV_HUGEPAGE) == 0 && advised && thp_enabled()) {
+        *advised += sz;
+    }
+#endif
+    return aligned;
+}
+
+/* Unmap a huge page mapping of (rounded) size SZ. */
+static void unmap_huge(void *p, size_t sz, size_t *advised) {
+    munmap(p, sz);
+    if (advised) *advised -= (*advised < sz ? *advised : sz);
+}
+
+void *oscar_hugepage_mem_cb(void *p, size_t old_sz,
+                            size_t new_sz, void *udata) {
+    size_t *advised = (size_t *) udata;
+    int old_huge = (p != NULL && old_sz >= OSCAR_HUGE_PAGE);
+    size_t old_map = (old_huge ? round_huge(old_sz) : 0);
+    size_t new_map = 0;
+    void *np = NULL;
+
+    if (new_sz == 0) {          /* free */
+        if (old_huge) {
+            unmap_huge(p, old_map, advised);
+        } else {
+            free(p);
+        }
+        return NULL;
+    }
+
+    if (new_sz < OSCAR_HUGE_PAGE) {
+        if (!old_huge) return realloc(p, new_sz);
+        np = malloc(new_sz);
+        if (np == NULL) return NULL;
+        memcpy(np, p, new_sz);
+        unmap_huge(p, old_map, advised);
+        return np;
+    }
+
+    new_map = round_huge(new_sz);
+    if (new_map == 0) return NULL;
+    if (old_huge && new_map == old_map) return p;
+    np = map_huge(new_map, advised);
+    if (np == NULL) return NULL;
+    if (p != NULL) {
+        memcpy(np, p, old_sz < new_sz ? old_sz : new_sz);
+        if (old_huge) {
+            unmap_huge(p, old_map, advised);
+        } else {
+            free(p);
+        }
+    }
+    return np;
+}
+
+oscar *oscar_new_hugepage(size_t cell_sz, size_t start_count,
+                          oscar_mark_cb *mark_cb, void *mark_udata,
+                          oscar_free_cb *free_cb, void *free_udata) {
+    oscar *p = NULL;
+    size_t bytes = 0, advised = 0;
+    if (cell_sz == 0 || start_count > SIZE_MAX / cell_sz) return NULL;
+    bytes = round_huge(cell_sz * start_count);
+    if (bytes == 0) return NULL;
+
+    p = oscar_new(cell_sz, bytes / cell_sz, oscar_hugepage_mem_cb, &advised,
+        mark_cb, mark_udata, free_cb, free_udata);
+    if (p == NULL) return NULL;
+
+    /* From now on, track huge pages in the pool itself. */
+    p->huge_bytes = advised;
+    p->mem_udata = &p->huge_bytes;
+    p->grow_step = OSCAR_HUGE_PAGE;
+    return p;
+}
+
+/* Snapshot file layout:
+ * [header][padding to a cache line][mark bits, MARK_BYTES]
+ * [padding to SNAPSHOT_ALIGN][cells, COUNT * CELL_SZ bytes]
+ * The cells are aligned generously, so they can be mapped directly
+ * on systems with pages of up to 64 KB. */
+#define SNAPSHOT_MAGIC "OSCARSNP"
+#define SNAPSHOT_BYTE_ORDER 0x01020304UL
+#define SNAPSHOT_ALIGN 65536
+
+typedef struct snapshot_header {
+    char magic[8];              /* SNAPSHOT_MAGIC */
+    uint32_t version;           /* OSCAR_SNAPSHOT_VERSION */
+    uint32_t byte_order;        /* SNAPSHOT_BYTE_ORDER, as written */
+    uint32_t id_size;           /* sizeof(pool_id) */
+    uint32_t pad;
+    uint64_t cell_sz;
+    uint64_t cell_align;
+    uint64_t count;
+    uint64_t max_count;
+    uint64_t marked;
+    uint64_t sweep;             /* lazy sweep index */
+    uint64_t mark_offset;       /* file offset of the mark bits */
+    uint64_t mark_bytes;
+    uint64_t cell_offset;       /* file offset of the cells */
+    uint64_t cell_bytes;
+} snapshot_header;
+
+static uint64_t align_offset(uint64_t n, uint64_t align) {
+    return (n + align - 1) / align * align;
+}
+
+static int write_all(int fd, const void *buf, size_t n, uint64_t offset) {
+    const char *p = (const char *) buf;
+    while (n > 0) {
+        ssize_t res = pwrite(fd, p, n, (off_t) offset);
+        if (res <= 0) return -1;
+        p += res;
+        n -= (size_t) res;
+        offset += (uint64_t) res;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t n, uint64_t offset) {
+    char *p = (char *) buf;
+    while (n > 0) {
+        ssize_t res = pread(fd, p, n, (off_t) offset);
+        if (res <= 0) return -1;
+        p += res;
+        n -= (size_t) res;
+        offset += (uint64_t) res;
+    }
+    return 0;
+}
+
+int oscar_snapshot(oscar *pool, int fd) {
+    snapshot_header h;
+    if (pool->spanbits) {
+        fprintf(stderr, "can't snapshot a pool with spans\n");
+        return -1;
+    }
+    if (pool->overflow) {
+        fprintf(stderr, "can't snapshot a pool with overflow cells\n");
+        return -1;
+    }
+    if (pool->flags & OSCAR_FLAG_EPOCH_MARKS) {
+        fprintf(stderr, "can't snapshot a pool with epoch marks\n");
+        return -1;
+    }
+    if (oscar_concurrent_marking(pool)) {
+        fprintf(stderr, "can't snapshot a pool while marking concurrently\n");
+        return -1;
+    }
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = OSCAR_SNAPSHOT_VERSION;
+    h.byte_order = SNAPSHOT_BYTE_ORDER;
+    h.id_size = sizeof(pool_id);
+    h.cell_sz = pool->cell_sz;
+    h.cell_align = pool->cell_align;
+    h.count = pool->count;
+    h.max_count = pool->max_count;
+    h.marked = pool->marked;
+    h.sweep = pool->sweep;
+    h.mark_offset = align_offset(sizeof(h), OSCAR_CACHE_LINE);
+    h.mark_bytes = (pool->count / 64 + 1) * sizeof(uint64_t);
+    h.cell_offset = align_offset(h.mark_offset + h.mark_bytes, SNAPSHOT_ALIGN);
+    h.cell_bytes = (uint64_t) pool->count * pool->cell_sz;
+
+    if (write_all(fd, &h, sizeof(h), 0) < 0) return -1;
+    if (write_all(fd, pool->markbits, h.mark_bytes, h.mark_offset) < 0)
+        return -1;
+    if (write_all(fd, pool->raw, h.cell_bytes, h.cell_offset) < 0) return -1;
+    return ftruncate(fd, (off_t) (h.cell_offset + h.cell_bytes));
+}
+
+/* Memory callback for restored pools, whose cells start out in a file
+ * mapping. If the pool grows, the cells are copied into malloc'd memory
+ * and the mapping is dropped. UDATA is the pool. */
+static void *mapped_mem_cb(void *p, size_t old_sz, size_t new_sz, void *udata) {
+    oscar *pool = (oscar *) udata;
+    void *np = NULL;
+    if (pool == NULL || p == NULL || p != pool->raw_base
+        || (pool->flags & OSCAR_FLAG_MAPPED_CELLS) == 0) {
+        return oscar_generic_mem_cb(p, old_sz, new_sz, NULL);
+    }
+
+    if (new_sz > 0) {
+        np = malloc(new_sz);
+        if (np == NULL) return NULL;
+        memcpy(np, p, old_sz < new_sz ? old_sz : new_sz);
+    }
+    munmap(p, old_sz);
+    pool->flags &= ~OSCAR_FLAG_MAPPED_CELLS;
+    return np;
+}
+
+oscar *oscar_restore(int fd,
+                     oscar_mark_cb *mark_cb, void *mark_udata,
+                     oscar_free_cb *free_cb, void *free_udata) {
+    snapshot_header h;
+    struct stat st;
+    oscar *p = NULL;
+    char *cells = NULL;
+
+#define FAIL(msg) { fprintf(stderr, msg "\n"); return NULL; }
+    if (read_all(fd, &h, sizeof(h), 0) < 0) FAIL("short snapshot");
+    if (memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0)
+        FAIL("not an oscar snapshot");
+    if (h.version != OSCAR_SNAPSHOT_VERSION)
+        FAIL("unsupported snapshot version");
+    if (h.byte_order != SNAPSHOT_BYTE_ORDER || h.id_size != sizeof(pool_id))
+        FAIL("snapshot is from an incompatible build");
+    if (h.count == 0 || h.count > SIZE_MAX || h.cell_sz > SIZE_MAX
+        || h.cell_bytes != h.count * h.cell_sz
+        || h.cell_bytes / h.count != h.cell_sz
+        || h.cell_bytes > SIZE_MAX
+        || h.mark_bytes != (h.count / 64 + 1) * sizeof(uint64_t)
+        || h.sweep > h.count || h.cell_offset % SNAPSHOT_ALIGN != 0)
+        FAIL("corrupt snapshot header");
+    if (fstat(fd, &st) < 0 || (uint64_t) st.st_size < h.cell_offset + h.cell_bytes)
+        FAIL("truncated snapshot");
+#undef FAIL
+
+    cells = mmap(NULL, (size_t) h.cell_bytes, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE, fd, (off_t) h.cell_offset);
+    if (cells == MAP_FAILED) return NULL;
+
+    p = oscar_new_with_cells((size_t) h.cell_sz, (size_t) h.cell_align,
+        (size_t) h.count, cells, (size_t) h.cell_bytes,
+        mapped_mem_cb, NULL, mark_cb, mark_udata, free_cb, free_udata);
+    if (p == NULL) {
+        munmap(cells, (size_t) h.cell_bytes);
+        return NULL;
+    }
+    p->flags |= OSCAR_FLAG_MAPPED_CELLS;
+    p->mem_udata = p;
+
+    if (read_all(fd, p->markbits, (size_t) h.mark_bytes, h.mark_offset) < 0) {
+        p->free_cb = NULL;
+        oscar_free(p);
+        return NULL;
+    }
+    p->max_count = (h.max_count < p->count ? p->count : (size_t) h.max_count);
+    p->marked = (size_t) h.marked;
+    p->sweep = (pool_id) h.sweep;
+    return p;
+}
+
+/* Shared pool layout: [header][padding to SHARED_CELL_OFFSET][cells].
+ * The header and cells are mapped separately; the cells mapping is
+ * replaced whenever the pool grows, but since the file only ever gets
+ * longer, readers' existing mappings stay valid until they sync. */
+#define SHARED_MAGIC "OSCARSHM"
+#define SHARED_CELL_OFFSET SNAPSHOT_ALIGN
+
+typedef struct shared_header {
+    char magic[8];              /* SHARED_MAGIC */
+    uint32_t version;           /* OSCAR_SHARED_VERSION */
+    uint32_t byte_order;        /* SNAPSHOT_BYTE_ORDER, as written */
+    uint32_t id_size;           /* sizeof(pool_id) */
+    uint32_t pad;
+    uint64_t cell_sz;
+    uint64_t cell_bytes;        /* bytes of cells published to readers */
+    uint64_t generation;        /* bumped on every collection and growth */
+} shared_header;
+
+/* Per-process state for a shared pool (writer or reader), used as its
+ * mem_udata. Freed along with the pool struct. */
+typedef struct shared_state {
+    oscar *pool;
+    shared_header *header;
+    int fd;
+    int writer;
+    oscar_mark_cb *mark_cb;     /* user's mark callback, for the writer */
+    void *mark_udata;
+} shared_state;
+
+#if defined(__GNUC__)
+#define LOAD_U64(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE_U64(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#else
+#define LOAD_U64(p) (*(volatile uint64_t *) (p))
+#define STORE_U64(p, v) (*(volatile uint64_t *) (p) = (v))
+#endif
+
+static void bump_generation(shared_header *h) {
+    STORE_U64(&h->generation, LOAD_U64(&h->generation) + 1);
+}
+
+static void free_state(shared_state *s) {
+    if (s->header) munmap(s->header, sizeof(*s->header));
+    if (s->fd >= 0) close(s->fd);
+    free(s);
+}
+
+static shared_state *new_state(int fd, int writer) {
+    shared_state *s = calloc(1, sizeof(*s));
+    if (s == NULL) return NULL;
+    s->fd = fd;
+    s->writer = writer;
+    s->header = mmap(NULL, sizeof(*s->header),
+        PROT_READ | (writer ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+    if (s->header == MAP_FAILED) {
+        s->header = NULL;
+        s->fd = -1;             /* still owned by the caller */
+        free_state(s);
+        return NULL;
+    }
+    return s;
+}
+
+/* Map BYTES of cells from S's file, read-only for readers. */
+static char *map_cells(shared_state *s, size_t bytes) {
+    char *cells = mmap(NULL, bytes,
+        PROT_READ | (s->writer ? PROT_WRITE : 0), MAP_SHARED,
+        s->fd, SHARED_CELL_OFFSET);
+    return (cells == MAP_FAILED ? NULL : cells);
+}
+
+/* Memory callback for shared pools. The cells are resized by extending
+ * the file and remapping it, so they are never copied; the pool struct
+ * and mark bits are private, and use malloc. UDATA is the shared_state. */
+static void *shared_mem_cb(void *p, size_t old_sz, size_t new_sz, void *udata) {
+    shared_state *s = (shared_state *) udata;
+    char *cells = NULL;
+
+    if (p != NULL && s->pool != NULL && p == s->pool->raw_base) {
+        if (new_sz == 0) {
+            munmap(p, old_sz);
+            return NULL;
+        }
+        if (!s->writer || new_sz < old_sz) return NULL;
+        if (ftruncate(s->fd, (off_t) (SHARED_CELL_OFFSET + new_sz)) < 0) {
+            return NULL;
+        }
+        cells = map_cells(s, new_sz);
+        if (cells == NULL) return NULL;
+        munmap(p, old_sz);
+        STORE_U64(&s->header->cell_bytes, new_sz);
+        bump_generation(s->header);
+        return cells;
+    }
+
+    if (p != NULL && p == s->pool && new_sz == 0) {
+        free(p);
+        free_state(s);
+        return NULL;
+    }
+    return oscar_generic_mem_cb(p, old_sz, new_sz, NULL);
+}
+
+/* Mark callback for the writer: start a new generation, then mark. */
+static int shared_mark_cb(oscar *pool, void *udata) {
+    shared_state *s = (shared_state *) udata;
+    bump_generation(s->header);
+    return s->mark_cb(pool, s->mark_udata);
+}
+
+/* Mark callback for readers, which can't collect. */
+static int reader_mark_cb(oscar *pool, void *udata) {
+    (void) pool;
+    (void) udata;
+    return -1;
+}
+
+/* Wrap the cells mapping CELLS (BYTES long) in a pool for S. Cleans up
+ * S and CELLS on failure. */
+static oscar *new_shared_pool(shared_state *s, size_t cell_sz,
+                              char *cells, size_t bytes,
+                              oscar_mark_cb *mark_cb, void *mark_udata,
+                              oscar_free_cb *free_cb, void *free_udata) {
+    oscar *p = oscar_new_with_cells(cell_sz, sizeof(void *), bytes / cell_sz,
+        cells, bytes, shared_mem_cb, s, mark_cb, mark_udata,
+        free_cb, free_udata);
+    if (p == NULL) {
+        munmap(cells, bytes);
+        free_state(s);
+        return NULL;
+    }
+    s->pool = p;
+    p->flags |= OSCAR_FLAG_MAPPED_CELLS;
+    return p;
+}
+
+oscar *oscar_new_shared(const char *name, size_t cell_sz, size_t start_count,
+                        oscar_mark_cb *mark_cb, void *mark_udata,
+                        oscar_free_cb *free_cb, void *free_udata) {
+    shared_state *s = NULL;
+    shared_header h;
+    oscar *p = NULL;
+    char *cells = NULL;
+    size_t bytes = 0;
+    int fd = -1;
+
+#define FAIL(msg) { fprintf(stderr, msg "\n"); return NULL; }
+    if (cell_sz < sizeof(pool_id) || (cell_sz % sizeof(void *)) != 0)
+        FAIL("bad cell_sz for shared pool");
+    if (start_count < 1 || start_count > (SIZE_MAX - SHARED_CELL_OFFSET) / cell_sz)
+        FAIL("bad count for shared pool");
+    if (mark_cb == NULL) FAIL("NULL mark_cb");
+#undef FAIL
+    bytes = cell_sz * start_count;
+
+    if (name == NULL) {
+#ifdef MFD_CLOEXEC
+        fd = memfd_create("oscar", MFD_CLOEXEC);
+#else
+        fprintf(stderr, "anonymous shared pools need memfd_create\n");
+        return NULL;
+#endif
+    } else {
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0) return NULL;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SHARED_MAGIC, sizeof(h.magic));
+    h.version = OSCAR_SHARED_VERSION;
+    h.byte_order = SNAPSHOT_BYTE_ORDER;
+    h.id_size = sizeof(pool_id);
+    h.cell_sz = cell_sz;
+    h.cell_bytes = bytes;
+    if (ftruncate(fd, (off_t) (SHARED_CELL_OFFSET + bytes)) < 0
+        || write_all(fd, &h, sizeof(h), 0) < 0) {
+        goto cleanup;
+    }
+
+    s = new_state(fd, 1);
+    if (s == NULL) goto cleanup;
+    fd = -1;                    /* now owned by S */
+    s->mark_cb = mark_cb;
+    s->mark_udata = mark_udata;
+    cells = map_cells(s, bytes);
+    if (cells == NULL) goto cleanup;
+    p = new_shared_pool(s, cell_sz, cells, bytes,
+        shared_mark_cb, s, free_cb, free_udata);
+    s = NULL;                   /* freed by new_shared_pool on failure */
+    if (p != NULL) return p;
+
+cleanup:
+    if (s) free_state(s);
+    if (fd >= 0) close(fd);
+    if (name) shm_unlink(name);
+    return NULL;
+}
+
+/* Get POOL's shared state, or NULL if it isn't a shared pool. */
+static shared_state *get_state(oscar *pool) {
+    if (pool->mem_cb != shared_mem_cb) return NULL;
+    return (shared_state *) pool->mem_udata;
+}
+
+void oscar_shared_released(oscar *pool) {
+    shared_state *s = get_state(pool);
+    if (s) bump_generation(s->header);
+}
+
+int oscar_shared_fd(oscar *pool) {
+    shared_state *s = get_state(pool);
+    return (s ? s->fd : -1);
+}
+
+oscar *oscar_attach_shared(int fd) {
+    shared_state *s = NULL;
+    shared_header h;
+    struct stat st;
+    oscar *p = NULL;
+    char *cells = NULL;
+    size_t bytes = 0;
+    int dfd = -1;
+
+#define FAIL(msg) { fprintf(stderr, msg "\n"); return NULL; }
+    if (read_all(fd, &h, sizeof(h), 0) < 0) FAIL("short shared pool header");
+    if (memcmp(h.magic, SHARED_MAGIC, sizeof(h.magic)) != 0)
+        FAIL("not an oscar shared pool");
+    if (h.version != OSCAR_SHARED_VERSION)
+        FAIL("unsupported shared pool version");
+    if (h.byte_order != SNAPSHOT_BYTE_ORDER || h.id_size != sizeof(pool_id))
+        FAIL("shared pool is from an incompatible build");
+    if (h.cell_sz == 0 || h.cell_sz > SIZE_MAX) FAIL("corrupt shared pool header");
+#undef FAIL
+
+    dfd = dup(fd);
+    if (dfd < 0) return NULL;
+    s = new_state(dfd, 0);
+    if (s == NULL) {
+        close(dfd);
+        return NULL;
+    }
+
+    /* Use the published size, which the file is always at least as big as. */
+    bytes = (size_t) LOAD_U64(&s->header->cell_bytes);
+    if (fstat(dfd, &st) < 0
+        || (uint64_t) st.st_size < SHARED_CELL_OFFSET + (uint64_t) bytes
+        || bytes < h.cell_sz) {
+        free_state(s);
+        return NULL;
+    }
+    cells = map_cells(s, bytes);
+    if (cells == NULL) {
+        free_state(s);
+        return NULL;
+    }
+    p = new_shared_pool(s, (size_t) h.cell_sz, cells, bytes,
+        reader_mark_cb, NULL, NULL, NULL);
+    if (p == NULL) return NULL;
+
+    /* The cells are mapped read-only, so refuse anything that would
+     * sweep or mark them. */
+    p->flags |= OSCAR_FLAG_READER;
+    p->sweep = (pool_id) p->count;
+    return p;
+}
+
+uint64_t oscar_shared_generation(oscar *pool) {
+    shared_state *s = get_state(pool);
+    return (s ? LOAD_U64(&s->header->generation) : 0);
+}
+
+int oscar_shared_sync(oscar *pool) {
+    shared_state *s = get_state(pool);
+    size_t bytes = 0, old_sz = 0;
+    char *cells = NULL, *old = NULL;
+    if (s == NULL) return -1;
+    if (s->writer) return 0;
+
+    bytes = (size_t) LOAD_U64(&s->header->cell_bytes);
+    if (bytes <= pool->sz) return 0;
+    cells = map_cells(s, bytes);
+    if (cells == NULL) return -1;
+
+    old = pool->raw_base;
+    old_sz = pool->sz;
+    if (oscar_set_cells(pool, cells, bytes, bytes / pool->cell_sz) < 0) {
+        munmap(cells, bytes);
+        return -1;
+    }
+    munmap(old, old_sz);
+    pool->sweep = (pool_id) pool->count;
+    return 0;
+}
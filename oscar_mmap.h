@@ -0,0 +1,107 @@
+/* For copyright notice, see oscar.h. */
+
+#ifndef OSCAR_MMAP_H
+#define OSCAR_MMAP_H
+
+/* Memory-mapping backends for oscar pools. These depend on POSIX mmap. */
+
+#include "oscar.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Size of a transparent huge page, in bytes. */
+#define OSCAR_HUGE_PAGE (2UL * 1024 * 1024)
+
+/* An oscar_memory_cb for large pools. Allocations of at least
+ * OSCAR_HUGE_PAGE bytes are rounded up to a whole number of huge pages,
+ * mapped on a huge page boundary, and advised (via MADV_HUGEPAGE) to use
+ * transparent huge pages, which cuts TLB misses while marking and
+ * accessing cells. Smaller allocations just use malloc.
+ * If UDATA is non-NULL, it is a size_t * tracking how many bytes are
+ * currently mapped with huge page advice while THP was enabled (in
+ * /sys/kernel/mm/transparent_hugepage/enabled). That's as much as can be
+ * known up front: the kernel may still back some of them with regular
+ * pages, e.g. if memory is fragmented, which only AnonHugePages in
+ * /proc/self/smaps shows. If THP is unavailable, the memory is still
+ * mapped, but with regular pages. */
+void *oscar_hugepage_mem_cb(void *p, size_t old_sz, size_t new_sz, void *udata);
+
+/* Init a resizable pool like oscar_new, but with its cells allocated by
+ * oscar_hugepage_mem_cb. START_COUNT is rounded up to fill a whole
+ * number of huge pages, and growth keeps it that way. How much of it was
+ * eligible for huge pages is reported by oscar_get_stats. */
+oscar *oscar_new_hugepage(size_t cell_sz, size_t start_count,
+    oscar_mark_cb *mark_cb, void *mark_udata,
+    oscar_free_cb *free_cb, void *free_udata);
+
+/* Current version of the snapshot format. */
+#define OSCAR_SNAPSHOT_VERSION 1
+
+/* Write a snapshot of POOL's cells and mark state to the start of FD.
+ * Snapshots are only portable between builds with the same byte order
+ * and pool_id size. Pools using oscar_alloc_span can't be snapshotted
+ * yet, nor can a pool in the middle of a concurrent cycle (see
+ * oscar_concurrent_marking). Returns <0 on error. */
+int oscar_snapshot(oscar *pool, int fd);
+
+/* Restore a pool from a snapshot at the start of FD. Rather than being
+ * read in, the cells are mapped copy-on-write from the file, so they are
+ * loaded lazily as they are touched, and changes don't affect the file.
+ * The cells are copied into memory if the pool grows. FD may be closed
+ * once this returns. The callbacks are as for oscar_new; the pool uses
+ * malloc/realloc/free for any further allocations. Returns NULL on error,
+ * such as a bad or incompatible snapshot. */
+oscar *oscar_restore(int fd,
+    oscar_mark_cb *mark_cb, void *mark_udata,
+    oscar_free_cb *free_cb, void *free_udata);
+
+/* Current version of the shared pool header. */
+#define OSCAR_SHARED_VERSION 1
+
+/* Init a resizable pool whose cells live in shared memory, so other
+ * processes can read them in place with oscar_attach_shared. If NAME is
+ * NULL, the memory is an anonymous memfd (Linux only), to be passed to
+ * readers by fork or over a socket; otherwise it is a new POSIX shared
+ * memory object created with shm_open(NAME), which the caller should
+ * shm_unlink when it is no longer needed. Only this pool (the writer)
+ * may allocate or collect. The other arguments are as for oscar_new.
+ * Returns NULL on error. */
+oscar *oscar_new_shared(const char *name, size_t cell_sz, size_t start_count,
+    oscar_mark_cb *mark_cb, void *mark_udata,
+    oscar_free_cb *free_cb, void *free_udata);
+
+/* Get the file descriptor for a shared pool's memory, or -1 if POOL is
+ * not shared. It remains owned by the pool. */
+int oscar_shared_fd(oscar *pool);
+
+/* Attach a read-only view of a shared pool, from a descriptor for its
+ * memory (as from oscar_shared_fd or shm_open). FD is duplicated, so
+ * the caller may close it. Cells are mapped rather than copied, so
+ * oscar_get sees the writer's changes directly. The view cannot
+ * allocate or collect: oscar_alloc and oscar_alloc_span return
+ * OSCAR_ID_NONE, and oscar_collect, oscar_force_gc and
+ * oscar_scope_begin fail, leaving the view as it was. Returns NULL on
+ * error. */
+oscar *oscar_attach_shared(int fd);
+
+/* Get a shared pool's generation, which the writer bumps at the start
+ * of every collection, whenever the pool grows, and when
+ * oscar_scope_end releases cells. A cell that is
+ * reachable at any point during a generation isn't reused until the
+ * generation changes, so a reader can check that it is unchanged after
+ * reading to know that the IDs it followed were still valid. Returns 0
+ * if POOL is not shared. */
+uint64_t oscar_shared_generation(oscar *pool);
+
+/* Bring a reader's view of a shared pool up to date with the writer,
+ * mapping any cells added since it was attached or last synced. Any
+ * pointers into the old cells become stale. Returns <0 on error. */
+int oscar_shared_sync(oscar *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,211 @@
+/* For copyright notice, see oscar.h. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "oscar.h"
+#include "oscar_inline.h"
+#include "oscar_internal.h"
+#include "oscar_profile.h"
+
+/* What's known about a sampled cell. */
+typedef struct sample {
+    pool_id id;                 /* the cell, or OSCAR_ID_NONE if empty */
+    unsigned int site;          /* site tag */
+    size_t born;                /* pool->cycles when allocated, plus 1 */
+} sample;
+
+struct oscar_profile {
+    size_t countdown;           /* allocations until the next sample */
+    unsigned int site;          /* current site tag */
+    size_t slots;               /* size of SAMPLES, a power of 2 (or 0) */
+    size_t used;                /* samples in SAMPLES */
+    sample *samples;            /* live samples, in an open-addressed
+                                 * hash table keyed by cell ID */
+    oscar_profile_report report;
+};
+
+/* Where ID's probe sequence starts. */
+static size_t home_slot(struct oscar_profile *prof, pool_id id) {
+    return (size_t) (((uint64_t) id * 0x9E3779B97F4A7C15ULL) >> 32)
+        & (prof->slots - 1);
+}
+
+/* Find ID's sample, or the empty slot where it would go. */
+static sample *find_sample(struct oscar_profile *prof, pool_id id) {
+    size_t i = home_slot(prof, id);
+    while (prof->samples[i].id != OSCAR_ID_NONE && prof->samples[i].id != id) {
+        i = (i + 1) & (prof->slots - 1);
+    }
+    return &prof->samples[i];
+}
+
+/* Double the table (or make the first one), rehashing every sample.
+ * Returns <0 on error. */
+static int grow_samples(struct oscar_profile *prof) {
+    sample *old = prof->samples;
+    size_t old_slots = prof->slots, i = 0;
+    size_t slots = (old_slots == 0 ? 64 : 2 * old_slots);
+    sample *ns = malloc(slots * sizeof(sample));
+    if (ns == NULL) return -1;
+    for (i = 0; i < slots; i++) ns[i].id = OSCAR_ID_NONE;
+    prof->samples = ns;
+    prof->slots = slots;
+    for (i = 0; i < old_slots; i++) {
+        if (old[i].id != OSCAR_ID_NONE) *find_sample(prof, old[i].id) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+/* Remove sample S, shifting later samples in its probe run back so
+ * none of them is left past an empty slot. */
+static void remove_sample(struct oscar_profile *prof, sample *s) {
+    size_t mask = prof->slots - 1;
+    size_t hole = (size_t) (s - prof->samples), i = hole;
+    for (;;) {
+        size_t home = 0;
+        i = (i + 1) & mask;
+        if (prof->samples[i].id == OSCAR_ID_NONE) break;
+        /* It can fill the hole unless its home is after the hole. */
+        home = home_slot(prof, prof->samples[i].id);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            prof->samples[hole] = prof->samples[i];
+            hole = i;
+        }
+    }
+    prof->samples[hole].id = OSCAR_ID_NONE;
+    prof->used--;
+}
+
+int oscar_profile_start(oscar *pool, size_t sample_every) {
+    struct oscar_profile *prof = NULL;
+    if (sample_every < 1) sample_every = 1;
+    oscar_profile_stop(pool);
+    prof = calloc(1, sizeof(*prof));
+    if (prof == NULL) return -1;
+    prof->countdown = sample_every;
+    prof->report.sample_every = sample_every;
+    pool->profile = prof;
+    return 0;
+}
+
+void oscar_profile_site(oscar *pool, unsigned int site) {
+    if (pool->profile == NULL) return;
+    if (site >= OSCAR_PROFILE_SITES) site = OSCAR_PROFILE_SITES - 1;
+    pool->profile->site = site;
+}
+
+/* Get the survival bucket for a cell that survived AGE collections. */
+static unsigned int age_bucket(size_t age) {
+    unsigned int b = 0;
+    while (age > 0 && b < OSCAR_PROFILE_BUCKETS - 1) {
+        age >>= 1;
+        b++;
+    }
+    return b;
+}
+
+void oscar_profile_allocated(oscar *pool, pool_id id) {
+    struct oscar_profile *prof = pool->profile;
+    sample *s = NULL;
+    if (--prof->countdown > 0) return;
+    prof->countdown = prof->report.sample_every;
+
+    /* Keep the table at most half full. */
+    if (2 * (prof->used + 1) > prof->slots && grow_samples(prof) < 0) {
+        return;                 /* skip this sample */
+    }
+    s = find_sample(prof, id);
+    if (s->id != OSCAR_ID_NONE) {
+        prof->report.site_retained[s->site]--;
+    } else {
+        s->id = id;
+        prof->used++;
+    }
+    s->born = pool->cycles + 1;
+    s->site = prof->site;
+    prof->report.sampled++;
+    prof->report.site_sampled[s->site]++;
+    prof->report.site_retained[s->site]++;
+}
+
+/* Count sample S as dead at AGE, and remove it. */
+static void record_death(struct oscar_profile *prof, sample *s, size_t age) {
+    prof->report.survival[age_bucket(age)]++;
+    prof->report.swept++;
+    prof->report.site_retained[s->site]--;
+    remove_sample(prof, s);
+}
+
+void oscar_profile_collected(oscar *pool) {
+    struct oscar_profile *prof = pool->profile;
+    size_t i = 0;
+    while (i < prof->slots) {
+        sample *s = &prof->samples[i];
+        if (s->id == OSCAR_ID_NONE || oscar_is_marked(pool, s->id)) {
+            i++;
+            continue;
+        }
+        /* The collection that found it dead doesn't count as survived.
+         * Removing it may shift a later sample into slot I, so look
+         * at I again. */
+        record_death(prof, s, pool->cycles > s->born
+            ? pool->cycles - s->born : 0);
+    }
+}
+
+void oscar_profile_swept(oscar *pool, pool_id id) {
+    struct oscar_profile *prof = pool->profile;
+    sample *s = NULL;
+    if (prof->used == 0) return;
+    s = find_sample(prof, id);
+    if (s->id == OSCAR_ID_NONE) return;
+    /* Released without a collection finding it dead: it survived every
+     * collection since it was allocated. */
+    record_death(prof, s, pool->cycles + 1 - s->born);
+}
+
+int oscar_profile_get(oscar *pool, oscar_profile_report *report) {
+    if (pool->profile == NULL) return -1;
+    memcpy(report, &pool->profile->report, sizeof(*report));
+    return 0;
+}
+
+void oscar_profile_print(oscar *pool, FILE *f) {
+    oscar_profile_report r;
+    unsigned int i = 0;
+    if (oscar_profile_get(pool, &r) < 0) return;
+
+    fprintf(f, "sampled %lu (1 in %lu), swept %lu\n",
+        (unsigned long) r.sampled, (unsigned long) r.sample_every,
+        (unsigned long) r.swept);
+    fprintf(f, "collections survived:\n");
+    for (i = 0; i < OSCAR_PROFILE_BUCKETS; i++) {
+        size_t lo = (i == 0 ? 0 : (size_t) 1 << (i - 1));
+        if (r.survival[i] == 0) continue;
+        if (i < 2) {
+            fprintf(f, "  %10lu: %lu\n",
+                (unsigned long) lo, (unsigned long) r.survival[i]);
+        } else {
+            fprintf(f, "  %4lu-%-5lu: %lu\n", (unsigned long) lo,
+                (unsigned long) (2 * lo - 1), (unsigned long) r.survival[i]);
+        }
+    }
+    fprintf(f, "site  sampled  retained\n");
+    for (i = 0; i < OSCAR_PROFILE_SITES; i++) {
+        if (r.site_sampled[i] == 0) continue;
+        fprintf(f, "%4u %8lu %9lu\n", i,
+            (unsigned long) r.site_sampled[i],
+            (unsigned long) r.site_retained[i]);
+    }
+}
+
+void oscar_profile_stop(oscar *pool) {
+    if (pool->profile == NULL) return;
+    free(pool->profile->samples);
+    free(pool->profile);
+    pool->profile = NULL;
+}
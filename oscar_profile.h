@@ -0,0 +1,64 @@
+/* For copyright notice, see oscar.h. */
+
+#ifndef OSCAR_PROFILE_H
+#define OSCAR_PROFILE_H
+
+/* Optional lifetime profiling, for deciding how to tune a pool: how many
+ * collections do cells survive, and which allocation sites hold on to
+ * cells? Every Nth allocation is sampled, recording the collection it
+ * was made in and a caller-supplied site tag; when a collection finds a
+ * sampled cell dead (or its scope releases it), its age (the number of
+ * collections it survived) is added to a histogram. Unsampled
+ * allocations only cost a counter decrement, and the samples are kept
+ * in a hash table sized by how many are live, not by the pool, so each
+ * collection only checks the live samples' mark bits. */
+
+#include <stdio.h>
+#include "oscar.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of allocation site tags, 0 to OSCAR_PROFILE_SITES - 1. */
+#define OSCAR_PROFILE_SITES 64
+
+/* Number of survival histogram buckets. Bucket 0 counts cells that
+ * died before their first collection, and bucket B > 0 counts cells
+ * that survived 2^(B-1) to 2^B - 1 collections. The last bucket also
+ * counts everything older. */
+#define OSCAR_PROFILE_BUCKETS 24
+
+/* Profile data for a pool, from oscar_profile_get. */
+typedef struct oscar_profile_report {
+    size_t sample_every;        /* 1 in this many allocations are sampled */
+    size_t sampled;             /* sampled allocations */
+    size_t swept;               /* sampled cells found dead since */
+    size_t survival[OSCAR_PROFILE_BUCKETS]; /* ages of dead samples */
+    size_t site_sampled[OSCAR_PROFILE_SITES]; /* samples per site */
+    size_t site_retained[OSCAR_PROFILE_SITES]; /* of which not yet dead */
+} oscar_profile_report;
+
+/* Start profiling POOL, sampling one in SAMPLE_EVERY allocations
+ * (at least 1). Cells aren't sampled until they are next allocated.
+ * Returns <0 on error. */
+int oscar_profile_start(oscar *pool, size_t sample_every);
+
+/* Set the site tag for POOL's following allocations. Tags past the
+ * last site are counted as the last site. */
+void oscar_profile_site(oscar *pool, unsigned int site);
+
+/* Get POOL's profile so far. Returns <0 if it isn't being profiled. */
+int oscar_profile_get(oscar *pool, oscar_profile_report *report);
+
+/* Print POOL's profile to F, as text. */
+void oscar_profile_print(oscar *pool, FILE *f);
+
+/* Stop profiling POOL, discarding its profile. */
+void oscar_profile_stop(oscar *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,118 @@
+/* For copyright notice, see oscar.h. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "oscar.h"
+#include "oscar_inline.h"
+#include "oscar_internal.h"
+#include "oscar_trace.h"
+
+struct oscar_trace {
+    FILE *f;                    /* trace output */
+    int err;                    /* did a write fail? */
+    uint64_t allocs;            /* allocation numbers handed out */
+    size_t cap;                 /* cells covered by NUMBERS */
+    uint64_t *numbers;          /* allocation number + 1, by cell ID;
+                                 * 0 if allocated before tracing */
+};
+
+static void put_byte(struct oscar_trace *t, unsigned int b) {
+    if (fputc((int) b, t->f) == EOF) t->err = 1;
+}
+
+/* Write V as an unsigned LEB128 varint. */
+static void put_varint(struct oscar_trace *t, uint64_t v) {
+    while (v >= 0x80) {
+        put_byte(t, (unsigned int) (v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    put_byte(t, (unsigned int) v);
+}
+
+/* Get the allocation number + 1 for ID, or 0 if it isn't known. */
+static uint64_t number_of(struct oscar_trace *t, pool_id id) {
+    return (id < t->cap ? t->numbers[id] : 0);
+}
+
+int oscar_trace_start(oscar *pool, FILE *f) {
+    struct oscar_trace *t = NULL;
+    (void) oscar_trace_stop(pool);
+    t = calloc(1, sizeof(*t));
+    if (t == NULL) return -1;
+    t->f = f;
+    if (fwrite("OSCARTRC", 8, 1, f) != 1) t->err = 1;
+    put_byte(t, OSCAR_TRACE_VERSION);
+    put_varint(t, pool->cell_sz);
+    put_varint(t, pool->count);
+    if (t->err) {
+        free(t);
+        return -1;
+    }
+    pool->trace = t;
+    return 0;
+}
+
+void oscar_trace_allocated(oscar *pool, pool_id id, size_t cells) {
+    struct oscar_trace *t = pool->trace;
+    if (id >= t->cap) {         /* cover the whole pool, as it's grown */
+        uint64_t *nn = realloc(t->numbers, pool->count * sizeof(uint64_t));
+        if (nn == NULL) {
+            t->err = 1;
+            return;
+        }
+        memset(nn + t->cap, 0, (pool->count - t->cap) * sizeof(uint64_t));
+        t->numbers = nn;
+        t->cap = pool->count;
+    }
+    t->numbers[id] = ++t->allocs;
+    if (cells == 1) {
+        put_byte(t, OSCAR_TRACE_ALLOC);
+    } else {
+        put_byte(t, OSCAR_TRACE_SPAN);
+        put_varint(t, cells);
+    }
+}
+
+void oscar_trace_marked(oscar *pool, pool_id id) {
+    struct oscar_trace *t = pool->trace;
+    uint64_t n = number_of(t, id);
+    if (n == 0) return;
+    put_byte(t, OSCAR_TRACE_MARK);
+    put_varint(t, n - 1);
+}
+
+void oscar_trace_gc(oscar *pool, int done) {
+    struct oscar_trace *t = pool->trace;
+    if (done) {
+        put_byte(t, OSCAR_TRACE_GC_END);
+        put_varint(t, pool->count);
+    } else {
+        put_byte(t, OSCAR_TRACE_GC_BEGIN);
+    }
+}
+
+void oscar_trace_write(oscar *pool, pool_id id, unsigned int slot,
+                       pool_id target) {
+    struct oscar_trace *t = pool->trace;
+    uint64_t n = 0;
+    if (t == NULL || (n = number_of(t, id)) == 0) return;
+    put_byte(t, OSCAR_TRACE_WRITE);
+    put_varint(t, n - 1);
+    put_varint(t, slot);
+    put_varint(t, (target == OSCAR_ID_NONE ? 0 : number_of(t, target)));
+}
+
+int oscar_trace_stop(oscar *pool) {
+    struct oscar_trace *t = pool->trace;
+    int res = 0;
+    if (t == NULL) return 0;
+    if (fflush(t->f) != 0) t->err = 1;
+    res = (t->err ? -1 : 0);
+    free(t->numbers);
+    free(t);
+    pool->trace = NULL;
+    return res;
+}
@@ -0,0 +1,61 @@
+/* For copyright notice, see oscar.h. */
+
+#ifndef OSCAR_TRACE_H
+#define OSCAR_TRACE_H
+
+/* Optional trace recording, for replaying a real workload's heap
+ * against other pool configurations (see replay.c). While a pool is
+ * traced, its allocations, marks, and collections are written to a
+ * compact binary trace, along with whatever references between cells
+ * the caller reports with oscar_trace_write -- the pool can't see what
+ * is stored in its cells, so those must be reported explicitly.
+ *
+ * Cells are named in the trace by allocation number, not pool ID, so
+ * the replay can put them wherever its own pool does. Only cells
+ * allocated while tracing are named; marks of (and references to)
+ * older cells are left out, so start tracing right after oscar_new.
+ * Marks are read from the mark bits once each collection's marking is
+ * done, so they are recorded however they were made. */
+
+#include <stdio.h>
+#include "oscar.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Trace format version, in the header after the magic "OSCARTRC". */
+#define OSCAR_TRACE_VERSION 1
+
+/* Trace records, each an opcode byte followed by unsigned LEB128
+ * varints. The header is the magic, the version byte, then the pool's
+ * cell_sz and cell count as varints. */
+typedef enum oscar_trace_op {
+    OSCAR_TRACE_ALLOC = 1,      /* (none) next allocation number */
+    OSCAR_TRACE_SPAN,           /* cells: ALLOC of a span of CELLS cells */
+    OSCAR_TRACE_MARK,           /* cell */
+    OSCAR_TRACE_WRITE,          /* cell, slot, target + 1 (0 for none) */
+    OSCAR_TRACE_GC_BEGIN,       /* (none) marking restarts */
+    OSCAR_TRACE_GC_END          /* count: cells in the pool after it */
+} oscar_trace_op;
+
+/* Start tracing POOL to F, which must be open for binary writing, and
+ * write the trace header. F is flushed but not closed when tracing
+ * stops. Returns <0 on error. */
+int oscar_trace_start(oscar *pool, FILE *f);
+
+/* Record that slot SLOT of cell ID now refers to cell TARGET (or to
+ * nothing, if TARGET is OSCAR_ID_NONE). Slots are the caller's to
+ * number, e.g. the index of a pool_id field. Does nothing if POOL
+ * isn't being traced. */
+void oscar_trace_write(oscar *pool, pool_id id, unsigned int slot,
+    pool_id target);
+
+/* Stop tracing POOL. Returns <0 if any of the trace failed to write. */
+int oscar_trace_stop(oscar *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
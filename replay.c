@@ -0,0 +1,365 @@
+/* For copyright notice, see oscar.h. */
+
+/* Replay a trace recorded with oscar_trace_start against a pool of
+ * another configuration, and print how it did, as one line of CSV.
+ *
+ * Usage: oscar_replay [-b dynamic|fixed|hugepage] [-c CELL_SZ]
+ *                     [-n COUNT] TRACE
+ *   -b    pool backend (default dynamic)
+ *   -c    cell size (default: the recorded one; either way, raised
+ *         to fit the recorded references, and rounded up to a
+ *         multiple of sizeof(void *))
+ *   -n    starting cell count, or the fixed pool's count
+ *         (default: the recorded starting count)
+ *
+ * The replayed graph has the same allocations and references as the
+ * recording, but the replay collects whenever its own pool fills up.
+ * The trace doesn't say what the workload's roots were, so a replayed
+ * collection treats every cell marked by the last recorded collection,
+ * and every cell allocated since it began, as a root. This keeps
+ * everything the workload could still reach, and never more than a
+ * collection's worth of extra garbage. */
+
+#define _DEFAULT_SOURCE         /* for clock_gettime */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "oscar.h"
+#include "oscar_inline.h"
+#include "oscar_mmap.h"
+#include "oscar_trace.h"
+
+typedef enum { DYNAMIC, FIXED, HUGEPAGE } backend;
+
+/* Each replayed cell starts with its allocation number + 1 (so the free
+ * callback can forget it), followed by its reference slots. */
+typedef struct cell {
+    uint64_t number;
+    pool_id slot[];             /* SLOTS of these */
+} cell;
+
+typedef struct replay {
+    oscar *p;
+    unsigned int slots;         /* reference slots per cell */
+    uint64_t allocs;            /* allocation numbers replayed */
+    size_t cap;                 /* entries in IDS */
+    pool_id *ids;               /* by allocation number, or OSCAR_ID_NONE
+                                 * once swept */
+    uint64_t *live;             /* allocation numbers marked by the last
+                                 * recorded collection */
+    size_t live_count;
+    size_t live_sz;
+    uint64_t since;             /* first allocation since it began */
+    pool_id *stack;             /* marking work list */
+    size_t stack_sz;
+
+    size_t recorded_collections;
+    size_t dropped_writes;      /* to cells the replay had already swept */
+    uint64_t mark_ns;
+} replay;
+
+/* The header fields and extent of a trace. */
+typedef struct trace_info {
+    size_t cell_sz;
+    size_t count;
+    unsigned int slots;         /* highest slot written, plus 1 */
+} trace_info;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static void *grow_array(void *a, size_t *sz, size_t elt) {
+    size_t nsz = (*sz == 0 ? 1024 : 2 * *sz);
+    void *na = realloc(a, nsz * elt);
+    if (na == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    *sz = nsz;
+    return na;
+}
+
+static void bad_trace(const char *why) {
+    fprintf(stderr, "bad trace: %s\n", why);
+    exit(1);
+}
+
+/* Read an unsigned LEB128 varint. */
+static uint64_t get_varint(FILE *f) {
+    uint64_t v = 0;
+    unsigned int shift = 0;
+    int c = 0;
+    do {
+        if ((c = fgetc(f)) == EOF) bad_trace("truncated record");
+        if (shift > 63) bad_trace("varint too long");
+        v |= (uint64_t) (c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return v;
+}
+
+static void read_header(FILE *f, trace_info *info) {
+    char magic[8];
+    if (fread(magic, 8, 1, f) != 1 || memcmp(magic, "OSCARTRC", 8) != 0) {
+        bad_trace("not a trace");
+    }
+    if (fgetc(f) != OSCAR_TRACE_VERSION) bad_trace("unknown version");
+    info->cell_sz = (size_t) get_varint(f);
+    info->count = (size_t) get_varint(f);
+}
+
+/* Read the whole trace once, to size the replay's cells. */
+static void scan_trace(FILE *f, trace_info *info) {
+    int op = 0;
+    info->slots = 0;
+    while ((op = fgetc(f)) != EOF) {
+        uint64_t slot = 0;
+        switch (op) {
+        case OSCAR_TRACE_ALLOC: case OSCAR_TRACE_GC_BEGIN:
+            break;
+        case OSCAR_TRACE_SPAN: case OSCAR_TRACE_MARK: case OSCAR_TRACE_GC_END:
+            (void) get_varint(f);
+            break;
+        case OSCAR_TRACE_WRITE:
+            (void) get_varint(f);
+            slot = get_varint(f);
+            (void) get_varint(f);
+            if (slot >= 1024) bad_trace("slot out of range");
+            if (slot >= info->slots) info->slots = (unsigned int) slot + 1;
+            break;
+        default:
+            bad_trace("unknown record");
+        }
+    }
+}
+
+static cell *get_cell(replay *r, pool_id id) {
+    return (cell *) oscar_get_unchecked(r->p, id);
+}
+
+static void push(replay *r, size_t *top, pool_id id) {
+    if (*top == r->stack_sz) {
+        r->stack = grow_array(r->stack, &r->stack_sz, sizeof(pool_id));
+    }
+    r->stack[(*top)++] = id;
+}
+
+static void mark_root(replay *r, size_t *top, pool_id id) {
+    if (id != OSCAR_ID_NONE && oscar_mark_inline(r->p, id)) push(r, top, id);
+}
+
+/* Mark the recorded live set and everything allocated since, then
+ * everything they refer to. */
+static int mark_roots(oscar *p, void *udata) {
+    replay *r = (replay *) udata;
+    size_t top = 0, i = 0;
+    uint64_t n = 0, t0 = now_ns();
+
+    for (i = 0; i < r->live_count; i++) {
+        mark_root(r, &top, r->ids[r->live[i]]);
+    }
+    for (n = r->since; n < r->allocs; n++) mark_root(r, &top, r->ids[n]);
+    while (top > 0) {
+        cell *c = get_cell(r, r->stack[--top]);
+        unsigned int s = 0;
+        for (s = 0; s < r->slots; s++) {
+            pool_id id = c->slot[s];
+            if (id != OSCAR_ID_NONE && oscar_mark_inline(p, id)) {
+                push(r, &top, id);
+            }
+        }
+    }
+    r->mark_ns += now_ns() - t0;
+    return 0;
+}
+
+static void forget_cell(oscar *p, pool_id id, void *udata) {
+    replay *r = (replay *) udata;
+    cell *c = get_cell(r, id);
+    if (c->number != 0) r->ids[c->number - 1] = OSCAR_ID_NONE;
+}
+
+static void replay_alloc(replay *r, size_t cells) {
+    pool_id id = (cells == 1 ? oscar_alloc(r->p)
+        : oscar_alloc_span(r->p, cells));
+    cell *c = NULL;
+    unsigned int i = 0;
+    if (id == OSCAR_ID_NONE) {
+        fprintf(stderr, "allocation %lu failed\n", (unsigned long) r->allocs);
+        exit(1);
+    }
+    if (r->allocs == r->cap) {
+        r->ids = grow_array(r->ids, &r->cap, sizeof(pool_id));
+    }
+    r->ids[r->allocs++] = id;
+    c = get_cell(r, id);
+    c->number = r->allocs;
+    for (i = 0; i < r->slots; i++) c->slot[i] = OSCAR_ID_NONE;
+}
+
+static void replay_write(replay *r, uint64_t n, uint64_t slot,
+                         uint64_t target) {
+    pool_id id = OSCAR_ID_NONE;
+    if (n >= r->allocs || target > r->allocs) bad_trace("unknown cell");
+    id = r->ids[n];
+    if (id == OSCAR_ID_NONE) {
+        r->dropped_writes++;
+        return;
+    }
+    get_cell(r, id)->slot[slot] = (target == 0 ? OSCAR_ID_NONE
+        : r->ids[target - 1]);
+}
+
+static void run(replay *r, FILE *f) {
+    int op = 0;
+    while ((op = fgetc(f)) != EOF) {
+        uint64_t n = 0, slot = 0;
+        switch (op) {
+        case OSCAR_TRACE_ALLOC:
+            replay_alloc(r, 1);
+            break;
+        case OSCAR_TRACE_SPAN:
+            replay_alloc(r, (size_t) get_varint(f));
+            break;
+        case OSCAR_TRACE_MARK:
+            n = get_varint(f);
+            if (n >= r->allocs) bad_trace("unknown cell");
+            if (r->live_count == r->live_sz) {
+                r->live = grow_array(r->live, &r->live_sz, sizeof(uint64_t));
+            }
+            r->live[r->live_count++] = n;
+            break;
+        case OSCAR_TRACE_WRITE:
+            n = get_varint(f);
+            slot = get_varint(f);
+            replay_write(r, n, slot, get_varint(f));
+            break;
+        case OSCAR_TRACE_GC_BEGIN:
+            r->live_count = 0;
+            r->since = r->allocs;
+            break;
+        case OSCAR_TRACE_GC_END:
+            (void) get_varint(f);
+            r->recorded_collections++;
+            break;
+        default:
+            bad_trace("unknown record");
+        }
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: oscar_replay [-b dynamic|fixed|hugepage] "
+        "[-c CELL_SZ] [-n COUNT] TRACE\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    backend b = DYNAMIC;
+    size_t cell_sz = 0, count = 0, min_sz = 0;
+    const char *path = NULL;
+    char *memory = NULL;
+    trace_info info;
+    oscar_stats stats;
+    replay r;
+    FILE *f = NULL;
+    uint64_t t0 = 0, dt = 0;
+    int i = 0;
+    static const char *backends[] = { "dynamic", "fixed", "hugepage" };
+
+    for (i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-b") && i + 1 < argc) {
+            const char *name = argv[++i];
+            if (0 == strcmp(name, "dynamic")) {
+                b = DYNAMIC;
+            } else if (0 == strcmp(name, "fixed")) {
+                b = FIXED;
+            } else if (0 == strcmp(name, "hugepage")) {
+                b = HUGEPAGE;
+            } else {
+                usage();
+            }
+        } else if (0 == strcmp(argv[i], "-c") && i + 1 < argc) {
+            cell_sz = (size_t) strtoul(argv[++i], NULL, 10);
+        } else if (0 == strcmp(argv[i], "-n") && i + 1 < argc) {
+            count = (size_t) strtoul(argv[++i], NULL, 10);
+        } else if (argv[i][0] == '-' || path != NULL) {
+            usage();
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL) usage();
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    read_header(f, &info);
+    scan_trace(f, &info);
+    if (cell_sz == 0) cell_sz = info.cell_sz;
+    if (count == 0) count = info.count;
+    min_sz = sizeof(cell) + info.slots * sizeof(pool_id);
+    if (cell_sz < min_sz) cell_sz = min_sz;
+    cell_sz = (cell_sz + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+
+    memset(&r, 0, sizeof(r));
+    r.slots = info.slots;
+    switch (b) {
+    case DYNAMIC:
+        r.p = oscar_new(cell_sz, count, oscar_generic_mem_cb, NULL,
+            mark_roots, &r, forget_cell, &r);
+        break;
+    case FIXED: {
+        size_t bytes = oscar_fixed_size(cell_sz, count, NULL);
+        memory = (bytes == 0 ? NULL : malloc(bytes));
+        if (memory != NULL) {
+            r.p = oscar_new_fixed(cell_sz, bytes, memory,
+                mark_roots, &r, forget_cell, &r);
+        }
+        break;
+    }
+    case HUGEPAGE:
+        r.p = oscar_new_hugepage(cell_sz, count,
+            mark_roots, &r, forget_cell, &r);
+        break;
+    }
+    if (r.p == NULL) {
+        fprintf(stderr, "failed to create pool\n");
+        return 1;
+    }
+
+    /* Replay from just after the header. */
+    rewind(f);
+    read_header(f, &info);
+    t0 = now_ns();
+    run(&r, f);
+    dt = now_ns() - t0;
+    fclose(f);
+
+    oscar_get_stats(r.p, &stats);
+    printf("backend,cell_sz,allocs,seconds,allocs_per_sec,"
+        "recorded_collections,collections,mark_ms,dropped_writes,"
+        "final_count\n");
+    printf("%s,%lu,%lu,%.3f,%.0f,%lu,%lu,%.2f,%lu,%lu\n",
+        backends[b], (unsigned long) cell_sz, (unsigned long) r.allocs,
+        dt / 1e9, (dt > 0 ? r.allocs / (dt / 1e9) : 0),
+        (unsigned long) r.recorded_collections,
+        (unsigned long) stats.collections, r.mark_ns / 1e6,
+        (unsigned long) r.dropped_writes, (unsigned long) stats.count);
+
+    oscar_free(r.p);
+    free(memory);
+    free(r.ids);
+    free(r.live);
+    free(r.stack);
+    return 0;
+}
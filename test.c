@@ -1,12 +1,22 @@
 /* For copyright notice, see oscar.h. */
 
+#define _DEFAULT_SOURCE         /* for MAP_ANONYMOUS under -std=c99 */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/mman.h>
 
 #include "oscar.h"
+#include "oscar_inline.h"
+#include "oscar_group.h"
+#include "oscar_heap.h"
+#include "oscar_mmap.h"
+#include "oscar_profile.h"
+#include "oscar_trace.h"
+#include "oscar_concurrent.h"
 #include "greatest.h"
 
 typedef struct link {
@@ -47,7 +57,7 @@ TEST basic_dynamic(int pad) {
         mark_from_zero, &zero_is_live,
         basic_free_hook, basic_freed);
     ASSERT(p);
-    unsigned int count = oscar_count(p);
+    size_t count = oscar_count(p);
     pool_id id = oscar_alloc(p);
     ASSERT_EQ(0, id);
     link *l = (link *) oscar_get(p, id);
@@ -105,13 +115,13 @@ TEST fixed_small() {
     int zero_is_live = 0;
     int collections = 0;
 
-#define SZ (88 /* sizeof(oscar) */ + 2*sizeof(link))
-    static char raw_mem[SZ];
-    oscar *p = oscar_new_fixed(sizeof(link), SZ, raw_mem,
+    static char raw_mem[1024];
+    size_t sz = oscar_fixed_size(sizeof(link), 1, raw_mem);
+    ASSERT(sz <= sizeof(raw_mem));
+    oscar *p = oscar_new_fixed(sizeof(link), sz, raw_mem,
         mark_from_zero, &zero_is_live, count_coll, &collections);
     ASSERTm("no oscar *", p);
-#undef SZ
-    unsigned int count = oscar_count(p);
+    size_t count = oscar_count(p);
     ASSERT_EQ(1, count);
 
     /* Repeatedly alloc; should get cell 0 every time, because it
@@ -132,7 +142,7 @@ TEST fixed_small() {
  * in statically allocated memory. */
 TEST basic_static(int pad) {
     int zero_is_live = 1;
-    int SZ = (88 + 10*(sizeof(link) + pad));
+    int SZ = oscar_fixed_size(sizeof(link) + pad, 10, NULL);
     int basic_freed[SZ];
     char raw_mem[SZ];
     oscar *p = oscar_new_fixed(sizeof(link), SZ, raw_mem,
@@ -140,7 +150,7 @@ TEST basic_static(int pad) {
         basic_free_hook, basic_freed);
     ASSERTm("no oscar *", p);
     bzero(basic_freed, SZ * sizeof(int));
-    unsigned int count = oscar_count(p);
+    size_t count = oscar_count(p);
     pool_id id = oscar_alloc(p);
     ASSERT_EQ(0, id);
     link *l = (link *) oscar_get(p, id);
@@ -207,8 +217,8 @@ static int check(oscar *p, pool_id root, int pad) {
         char *raw = (char *) l + sizeof(*l);
         for (int i=0; i<pad; i++) {
             if (raw[i] != i % 256) {
-                fprintf(stderr, "corruption, pad %d, id %d, %d: %d\n",
-                    pad, id, i, raw[i]);
+                fprintf(stderr, "corruption, pad %d, id %lu, %d: %d\n",
+                    pad, (unsigned long) id, i, raw[i]);
                 return 0;
             }
         }
@@ -229,7 +239,7 @@ TEST growth(int pad) {
         basic_free_hook, freed);
     ASSERT(p);
 
-    unsigned int count = oscar_count(p);
+    size_t count = oscar_count(p);
     ASSERT_EQ(2, count);
 
     pool_id id = oscar_alloc(p);
@@ -264,6 +274,1678 @@ TEST growth(int pad) {
     PASS();
 }
 
+/* Memory callback that returns memory at varying offsets from malloc's
+ * alignment, so regions move to differently aligned addresses when
+ * they are resized. The offset is stored just before the pointer. */
+static void *shifty_mem_cb(void *p, size_t old_sz,
+                           size_t new_sz, void *udata) {
+    int *calls = (int *) udata;
+    size_t shift = sizeof(size_t) * (1 + (*calls)++ % 3);
+    char *base = NULL, *np = NULL;
+    if (new_sz > 0) {
+        base = malloc(new_sz + 4 * sizeof(size_t));
+        if (base == NULL) return NULL;
+        np = base + shift;
+        ((size_t *) np)[-1] = shift;
+        if (p) memcpy(np, p, old_sz < new_sz ? old_sz : new_sz);
+    }
+    if (p) free((char *) p - ((size_t *) p)[-1]);
+    return np;
+}
+
+/* Check that the mark bits and (optionally) cells are cache-line
+ * aligned, even as the pool grows and its regions move. */
+TEST aligned_cells(int cell_align) {
+    int zero_is_live = 1;
+    int calls = 0;
+    int limit = 1000;
+    int freed[4*limit];
+    oscar *p = oscar_new_aligned(sizeof(link), cell_align, 2,
+        shifty_mem_cb, &calls, mark_from_zero, &zero_is_live,
+        basic_free_hook, freed);
+    ASSERT(p);
+    ASSERT_EQ(0, (uintptr_t) p->markbits % OSCAR_CACHE_LINE);
+
+    pool_id last_id = oscar_alloc(p);
+    for (int i=0; i<limit; i++) {
+        pool_id id = oscar_alloc(p);
+        ASSERT(id != OSCAR_ID_NONE);
+        ASSERT_EQ(0, (uintptr_t) p->markbits % OSCAR_CACHE_LINE);
+        link *last = (link *) oscar_get(p, last_id);
+        ASSERT_EQ(0, (uintptr_t) last % cell_align);
+        last->d = (void *) ((intptr_t) last_id);
+        last->n = id;
+        last_id = id;
+    }
+    link *final = (link *) oscar_get(p, last_id);
+    final->d = (void *) ((intptr_t) last_id);
+    ASSERT_EQ(1, check(p, 0, 0));
+    ASSERT(calls > 4);
+
+    oscar_free(p);
+    PASS();
+}
+
+/* Like mark_from_zero, but using the inline accessors, and checking
+ * that each cell is only newly marked once. */
+static int mark_from_zero_inline(oscar *p, void *udata) {
+    int *zero_is_live = (int *) udata;
+    pool_id id = 0;
+    if (!*zero_is_live) return 0;
+
+    do {
+        link *n = (link *) oscar_get_inline(p, id);
+        if (n == NULL) return -1;
+        if (!oscar_mark_inline(p, id)) return -1;
+        if (oscar_mark_inline(p, id)) return -1;
+        id = n->n;
+    } while (id != 0);
+    return 0;
+}
+
+/* Check that the inline accessors agree with the out-of-line ones. */
+TEST inline_accessors() {
+    int zero_is_live = 1;
+    int freed[64];
+    oscar *p = oscar_new(sizeof(link), 4, oscar_generic_mem_cb, NULL,
+        mark_from_zero_inline, &zero_is_live, basic_free_hook, freed);
+    ASSERT(p);
+
+    pool_id last = oscar_alloc(p);
+    for (int i=0; i<20; i++) {
+        pool_id id = oscar_alloc(p);
+        ASSERT(id != OSCAR_ID_NONE);
+        link *l = (link *) oscar_get_inline(p, last);
+        ASSERT_EQ(oscar_get(p, last), l);
+        ASSERT_EQ(oscar_get_unchecked(p, last), l);
+        l->n = id;
+        last = id;
+    }
+
+    size_t count = oscar_count(p);
+    ASSERT_EQ(NULL, oscar_get_inline(p, count));
+    ASSERT_EQ(0, oscar_mark_inline(p, count));
+    ASSERT_EQ(0, oscar_force_gc(p));
+
+    oscar_free(p);
+    PASS();
+}
+
+/* Heap objects of varying sizes, chained together across classes. */
+typedef struct hobj {
+    pool_id next;               /* next heap ID, or OSCAR_ID_NONE */
+    int magic;                  /* HOBJ_MAGIC if part of the chain */
+    int value;
+} hobj;
+#define HOBJ_MAGIC 0x0bec7
+
+typedef struct heap_state {
+    pool_id root;
+    int chain_freed;
+} heap_state;
+
+static int heap_mark(oscar_heap *h, void *udata) {
+    heap_state *s = (heap_state *) udata;
+    pool_id id = s->root;
+    while (id != OSCAR_ID_NONE) {
+        hobj *o = (hobj *) oscar_heap_get(h, id);
+        if (o == NULL) return -1;
+        oscar_heap_mark(h, id);
+        id = o->next;
+    }
+    return 0;
+}
+
+static void heap_free_hook(oscar_heap *h, pool_id id, void *udata) {
+    heap_state *s = (heap_state *) udata;
+    hobj *o = (hobj *) oscar_heap_get(h, id);
+    if (o->magic == HOBJ_MAGIC) s->chain_freed++;
+}
+
+/* Build a chain through several size classes, churn every class
+ * until each has collected, and check the chain survives. */
+TEST heap_classes() {
+    heap_state s = { OSCAR_ID_NONE, 0 };
+    oscar_heap *h = oscar_heap_new(NULL, 0, 4,
+        oscar_generic_mem_cb, NULL, heap_mark, &s, heap_free_hook, &s);
+    ASSERT(h);
+
+    ASSERT_EQ(16, oscar_heap_cell_size(h, oscar_heap_alloc(h, 8)));
+    ASSERT_EQ(128, oscar_heap_cell_size(h, oscar_heap_alloc(h, 100)));
+    ASSERT_EQ(1024, oscar_heap_cell_size(h, oscar_heap_alloc(h, 1024)));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_heap_alloc(h, 1025));
+
+    static const size_t sizes[] = { 12, 500, 16, 100, 40, 1000 };
+    pool_id last = OSCAR_ID_NONE;
+    for (int i=0; i<60; i++) {
+        pool_id id = oscar_heap_alloc(h, sizes[i % 6]);
+        ASSERT(id != OSCAR_ID_NONE);
+        hobj *o = (hobj *) oscar_heap_get(h, id);
+        o->next = OSCAR_ID_NONE;
+        o->magic = HOBJ_MAGIC;
+        o->value = i;
+        if (last == OSCAR_ID_NONE) {
+            s.root = id;
+        } else {
+            ((hobj *) oscar_heap_get(h, last))->next = id;
+        }
+        last = id;
+    }
+
+    for (int i=0; i<2000; i++) {
+        pool_id id = oscar_heap_alloc(h, sizes[i % 6]);
+        ASSERT(id != OSCAR_ID_NONE);
+    }
+    ASSERT_EQ(0, s.chain_freed);
+
+    int seen = 0;
+    for (pool_id id = s.root; id != OSCAR_ID_NONE; seen++) {
+        hobj *o = (hobj *) oscar_heap_get(h, id);
+        ASSERT_EQ(seen, o->value);
+        id = o->next;
+    }
+    ASSERT_EQ(60, seen);
+
+    s.root = OSCAR_ID_NONE;
+    ASSERT_EQ(0, oscar_heap_force_gc(h));
+    ASSERT_EQ(60, s.chain_freed);
+
+    oscar_heap_free(h);
+    PASS();
+}
+
+/* Check that a huge page pool fills whole huge pages, stays aligned to
+ * them as it grows, and reports whether it could get any. */
+TEST hugepage_pool() {
+    int zero_is_live = 1;
+    oscar *p = oscar_new_hugepage(sizeof(link), 1000,
+        mark_from_zero, &zero_is_live, NULL, NULL);
+    ASSERT(p);
+    size_t count = oscar_count(p);
+    ASSERT_EQ(OSCAR_HUGE_PAGE / sizeof(link), count);
+    ASSERT_EQ(0, (uintptr_t) oscar_get(p, 0) % OSCAR_HUGE_PAGE);
+
+    oscar_stats stats;
+    oscar_get_stats(p, &stats);
+    ASSERT_EQ(count, stats.count);
+    ASSERT(stats.bytes >= OSCAR_HUGE_PAGE);
+    int have_thp = stats.huge_bytes > 0;
+    FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (f != NULL) {
+        char buf[128] = "";
+        if (fgets(buf, sizeof(buf), f) && strstr(buf, "[never]")) {
+            ASSERT_FALSEm("advice counted with THP off", have_thp);
+        }
+        fclose(f);
+    }
+
+    /* Link every cell, so the pool has to grow. */
+    pool_id last_id = oscar_alloc(p);
+    for (size_t i=0; i<count; i++) {
+        pool_id id = oscar_alloc(p);
+        ASSERT(id != OSCAR_ID_NONE);
+        link *last = (link *) oscar_get(p, last_id);
+        last->d = (void *) ((intptr_t) last_id);
+        last->n = id;
+        last_id = id;
+    }
+    link *final = (link *) oscar_get(p, last_id);
+    final->d = (void *) ((intptr_t) last_id);
+    ASSERT_EQ(1, check(p, 0, 0));
+
+    ASSERT(oscar_count(p) > count);
+    ASSERT_EQ(0, (oscar_count(p) * sizeof(link)) % OSCAR_HUGE_PAGE);
+    ASSERT_EQ(0, (uintptr_t) oscar_get(p, 0) % OSCAR_HUGE_PAGE);
+    oscar_get_stats(p, &stats);
+    if (have_thp) ASSERT(stats.huge_bytes >= oscar_count(p) * sizeof(link));
+
+    oscar_free(p);
+    PASS();
+}
+
+/* Build a linked list of LIMIT cells from cell 0, which is the root. */
+static int build_list(oscar *p, int limit) {
+    pool_id last_id = oscar_alloc(p);
+    if (last_id != 0) return 0;
+    for (int i=0; i<limit; i++) {
+        pool_id id = oscar_alloc(p);
+        if (id == OSCAR_ID_NONE) return 0;
+        link *last = (link *) oscar_get(p, last_id);
+        last->d = (void *) ((intptr_t) last_id);
+        last->n = id;
+        last_id = id;
+    }
+    ((link *) oscar_get(p, last_id))->d = (void *) ((intptr_t) last_id);
+    return 1;
+}
+
+typedef struct span_state {
+    pool_id roots[2];           /* span IDs to keep */
+    size_t root_count;
+    pool_id watched;            /* span whose frees are counted */
+    size_t watched_len;
+    int head_frees;             /* free_cb calls on WATCHED */
+    int inner_frees;            /* free_cb calls inside WATCHED */
+} span_state;
+
+static int mark_span_roots(oscar *p, void *udata) {
+    span_state *s = (span_state *) udata;
+    for (size_t i=0; i<s->root_count; i++) oscar_mark(p, s->roots[i]);
+    return 0;
+}
+
+static void span_free_hook(oscar *p, pool_id id, void *udata) {
+    span_state *s = (span_state *) udata;
+    if (id == s->watched) {
+        s->head_frees++;
+    } else if (id > s->watched && id < s->watched + s->watched_len) {
+        s->inner_frees++;
+    }
+}
+
+/* Check that spans stay contiguous and intact while single cells churn
+ * around them, and are swept as one unit once unreachable. */
+TEST span_arrays() {
+    span_state s;
+    memset(&s, 0, sizeof(s));
+    s.watched = OSCAR_ID_NONE;
+    oscar *p = oscar_new(sizeof(intptr_t), 4, oscar_generic_mem_cb, NULL,
+        mark_span_roots, &s, span_free_hook, &s);
+    ASSERT(p);
+
+    pool_id a = oscar_alloc_span(p, 10);
+    ASSERT(a != OSCAR_ID_NONE);
+    ASSERT(oscar_count(p) >= 10);
+    ASSERT_EQ(10, oscar_span_length(p, a));
+    ASSERT_EQ(0, oscar_span_length(p, a + 1));
+    intptr_t *cells = (intptr_t *) oscar_get(p, a);
+    for (int i=0; i<10; i++) cells[i] = i + 1;
+    s.roots[s.root_count++] = a;
+    s.watched = a;
+    s.watched_len = 10;
+
+    pool_id b = oscar_alloc_span(p, 20);
+    ASSERT(b != OSCAR_ID_NONE);
+    ASSERT(b >= a + 10 || b + 20 <= a);
+    s.roots[s.root_count++] = b;
+
+    for (int i=0; i<1000; i++) {
+        pool_id id = oscar_alloc(p);
+        ASSERT(id != OSCAR_ID_NONE);
+        ASSERT(id < a || id >= a + 10);
+        ASSERT(id < b || id >= b + 20);
+        *(intptr_t *) oscar_get(p, id) = -1;
+    }
+    ASSERT_EQ(0, oscar_force_gc(p));
+
+    cells = (intptr_t *) oscar_get(p, a);
+    for (int i=0; i<10; i++) ASSERT_EQ(i + 1, cells[i]);
+    ASSERT_EQ(0, s.head_frees);
+    ASSERT_EQ(0, s.inner_frees);
+
+    /* Drop A: it's freed once, as a whole. */
+    s.roots[0] = b;
+    s.root_count = 1;
+    ASSERT_EQ(0, oscar_force_gc(p));
+    ASSERT_EQ(1, s.head_frees);
+    ASSERT_EQ(0, s.inner_frees);
+    ASSERT_EQ(1, oscar_span_length(p, a + 1));
+    ASSERT_EQ(0, *(intptr_t *) oscar_get(p, a + 9));
+    ASSERT_EQ(20, oscar_span_length(p, b));
+
+    /* Freeing the pool calls free_cb on B once, too. */
+    s.watched = b;
+    s.watched_len = 20;
+    s.head_frees = 0;
+    oscar_free(p);
+    ASSERT_EQ(1, s.head_frees);
+    ASSERT_EQ(0, s.inner_frees);
+    PASS();
+}
+
+typedef struct scope_state {
+    pool_id root;               /* kept if not OSCAR_ID_NONE */
+    pool_id lo, hi;             /* range of cells whose frees are counted */
+    int frees;
+} scope_state;
+
+static int mark_scope_root(oscar *p, void *udata) {
+    scope_state *s = (scope_state *) udata;
+    if (s->root != OSCAR_ID_NONE) oscar_mark(p, s->root);
+    return 0;
+}
+
+static void scope_free_hook(oscar *p, pool_id id, void *udata) {
+    scope_state *s = (scope_state *) udata;
+    if (id >= s->lo && id < s->hi) s->frees++;
+}
+
+/* Check that a scope's cells survive collections while it is open, and
+ * are all released when it ends, except for the one that escapes. */
+TEST scoped_alloc() {
+    scope_state s = { OSCAR_ID_NONE, 0, 0, 0 };
+    oscar *p = oscar_new(sizeof(intptr_t), 16, oscar_generic_mem_cb, NULL,
+        mark_scope_root, &s, scope_free_hook, &s);
+    ASSERT(p);
+
+    oscar_scope scope;
+    ASSERT_EQ(0, oscar_scope_begin(p, &scope, 100));
+    pool_id ids[50], escaped = OSCAR_ID_NONE;
+    for (int i=0; i<50; i++) {
+        ids[i] = oscar_scope_alloc(&scope);
+        ASSERT(ids[i] != OSCAR_ID_NONE);
+        *(intptr_t *) oscar_get(p, ids[i]) = i + 1;
+    }
+    s.lo = ids[0];
+    s.hi = ids[49] + 1;
+    escaped = ids[7];
+    oscar_scope_escape(&scope, escaped);
+
+    /* Nothing is rooted, but the open scope keeps its cells. */
+    ASSERT_EQ(0, oscar_force_gc(p));
+    ASSERT_EQ(0, s.frees);
+    for (int i=0; i<50; i++) {
+        ASSERT_EQ(i + 1, *(intptr_t *) oscar_get(p, ids[i]));
+    }
+
+    /* An inner scope can use up its reservation. */
+    oscar_scope inner;
+    ASSERT_EQ(0, oscar_scope_begin(p, &inner, 2));
+    ASSERT(oscar_scope_alloc(&inner) != OSCAR_ID_NONE);
+    ASSERT(oscar_scope_alloc(&inner) != OSCAR_ID_NONE);
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_scope_alloc(&inner));
+    oscar_scope_end(&inner);
+
+    oscar_scope_end(&scope);
+    ASSERT_EQ(49, s.frees);
+    ASSERT_EQ(8, *(intptr_t *) oscar_get(p, escaped));
+    ASSERT_EQ(0, *(intptr_t *) oscar_get(p, ids[8]));
+
+    /* The escaped cell is ordinary now: live while rooted. */
+    s.root = escaped;
+    s.frees = 0;
+    for (int i=0; i<200; i++) ASSERT(oscar_alloc(p) != escaped);
+    ASSERT_EQ(0, oscar_force_gc(p));
+    ASSERT_EQ(8, *(intptr_t *) oscar_get(p, escaped));
+
+    oscar_free(p);
+    PASS();
+}
+
+typedef struct live_visit {
+    pool_id ids[256];
+    size_t count;
+    size_t stop_after;          /* return -1 after this many, if nonzero */
+} live_visit;
+
+static int visit_live(oscar *p, pool_id id, void *cell, void *udata) {
+    live_visit *v = (live_visit *) udata;
+    if (cell != oscar_get(p, id) || v->count == 256) return -2;
+    v->ids[v->count++] = id;
+    return (v->count == v->stop_after ? -1 : 0);
+}
+
+/* Check that the live cell walkers agree with each other, and only
+ * visit the cells reachable from the root, in order. */
+TEST live_iteration() {
+    int zero_is_live = 1;
+    oscar *p = oscar_new(sizeof(link), 512, oscar_generic_mem_cb, NULL,
+        mark_from_zero, &zero_is_live, NULL, NULL);
+    ASSERT(p);
+    ASSERT(build_list(p, 100));
+    for (int i=0; i<200; i++) ASSERT(oscar_alloc(p) != OSCAR_ID_NONE);
+    ASSERT_EQ(0, oscar_force_gc(p));
+
+    live_visit all;
+    memset(&all, 0, sizeof(all));
+    ASSERT_EQ(0, oscar_foreach_live(p, visit_live, &all));
+    ASSERT_EQ(101, all.count);
+    for (size_t i=1; i<all.count; i++) ASSERT(all.ids[i - 1] < all.ids[i]);
+    for (size_t i=0; i<all.count; i++) {
+        link *l = (link *) oscar_get(p, all.ids[i]);
+        ASSERT_EQ((intptr_t) all.ids[i], (intptr_t) l->d);
+    }
+
+    /* The iterator sees the same cells. */
+    oscar_live_iter it;
+    oscar_live_iter_init(p, &it);
+    for (size_t i=0; i<all.count; i++) ASSERT_EQ(all.ids[i], oscar_live_next(&it));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_live_next(&it));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_live_next(&it));
+
+    /* So do unaligned chunks, together. */
+    live_visit chunks;
+    memset(&chunks, 0, sizeof(chunks));
+    size_t cuts[] = { 0, 37, 64, 100, 129, oscar_count(p) };
+    for (int i=0; i<5; i++) {
+        ASSERT_EQ(0, oscar_foreach_live_range(p, cuts[i], cuts[i + 1],
+                visit_live, &chunks));
+    }
+    ASSERT_EQ(all.count, chunks.count);
+    ASSERT_EQ(0, memcmp(all.ids, chunks.ids, all.count * sizeof(pool_id)));
+
+    /* Callbacks can stop early. */
+    live_visit some;
+    memset(&some, 0, sizeof(some));
+    some.stop_after = 3;
+    ASSERT_EQ(-1, oscar_foreach_live(p, visit_live, &some));
+    ASSERT_EQ(3, some.count);
+
+    oscar_free(p);
+    PASS();
+}
+
+static void count_frees(oscar *p, pool_id id, void *udata) {
+    (*(int *) udata)++;
+}
+
+/* Drive collection by hand: oscar_try_alloc never collects or grows,
+ * and cells swept by oscar_sweep_step aren't finalized again. */
+TEST scheduled_gc() {
+    int zero_is_live = 1, frees = 0;
+    oscar *p = oscar_new(sizeof(link), 64, oscar_generic_mem_cb, NULL,
+        mark_from_zero, &zero_is_live, count_frees, &frees);
+    ASSERT(p);
+    ASSERT(build_list(p, 9));
+    size_t count = oscar_count(p);
+    ASSERT_EQ(0, oscar_gc_needed(p));
+
+    while (oscar_try_alloc(p) != OSCAR_ID_NONE) {}
+    ASSERT(oscar_gc_needed(p));
+    ASSERT_EQ(count, oscar_count(p));
+
+    ASSERT_EQ(0, oscar_collect(p));
+    ASSERT_EQ(0, oscar_gc_needed(p));
+    ASSERT_EQ(count, oscar_count(p));
+    ASSERT_EQ(1, check(p, 0, 0));
+
+    /* Sweep in small steps, as an idle loop would. */
+    frees = 0;
+    size_t left = count, steps = 0;
+    while ((left = oscar_sweep_step(p, 16)) > 0) steps++;
+    ASSERT(steps >= count / 16 - 1);
+    ASSERT_EQ(count - 10, frees);
+
+    frees = 0;
+    for (size_t i=0; i<count - 10; i++) {
+        ASSERT(oscar_try_alloc(p) != OSCAR_ID_NONE);
+    }
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_try_alloc(p));
+    ASSERT_EQ(0, frees);
+    ASSERT_EQ(1, check(p, 0, 0));
+
+    oscar_free(p);
+    PASS();
+}
+
+typedef struct spill_state {
+    pool_id roots[256];
+    size_t root_count;
+    int warnings;               /* watermark_cb calls */
+    int above;                  /* ... and the last one's arguments */
+    size_t live;
+} spill_state;
+
+static int mark_spill_roots(oscar *p, void *udata) {
+    spill_state *s = (spill_state *) udata;
+    for (size_t i=0; i<s->root_count; i++) oscar_mark(p, s->roots[i]);
+    return 0;
+}
+
+static void spill_watermark(oscar *p, size_t live, int above, void *udata) {
+    spill_state *s = (spill_state *) udata;
+    s->warnings++;
+    s->above = above;
+    s->live = live;
+}
+
+/* Fill a fixed pool past its own cells, so it spills into its overflow
+ * without disturbing any cell, then drop the roots and check that the
+ * overflow is given back, past its last live cell. */
+TEST fixed_overflow_spill() {
+    static char mem[4096];
+    spill_state s;
+    memset(&s, 0, sizeof(s));
+    size_t sz = oscar_fixed_size(sizeof(uint64_t), 64, mem);
+    ASSERT(sz <= sizeof(mem));
+    oscar *p = oscar_new_fixed(sizeof(uint64_t), sz, mem,
+        mark_spill_roots, &s, NULL, NULL);
+    ASSERT(p);
+    size_t n = oscar_count(p);  /* about 64, depending on padding */
+    ASSERT(n > 32 && n <= 64);
+    oscar_stats st;
+    oscar_get_stats(p, &st);
+    size_t fixed_bytes = st.bytes;
+    ASSERT_EQ(0, oscar_set_overflow(p, 192, oscar_generic_mem_cb, NULL));
+    oscar_set_watermark(p, n, spill_watermark, &s);
+
+    for (size_t i=0; i<n + 192; i++) {
+        pool_id id = oscar_alloc(p);
+        ASSERT_EQ(i, id);       /* fixed cells first, then overflow */
+        *(uint64_t *) oscar_get(p, id) = 1000 + i;
+        s.roots[s.root_count++] = id;
+    }
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_alloc(p)); /* the overflow is full */
+    ASSERT_EQ(n + 192, oscar_count(p));
+    for (size_t i=0; i<n + 192; i++) {
+        ASSERT_EQ(1000 + i, *(uint64_t *) oscar_get(p, (pool_id) i));
+        ASSERT_EQ(oscar_get(p, (pool_id) i), oscar_get_inline(p, (pool_id) i));
+    }
+    ASSERT_EQ(NULL, oscar_get_inline(p, (pool_id) (n + 192)));
+    ASSERT_EQ(1, s.warnings);
+    ASSERT(s.above);
+    ASSERT_EQ(-1, oscar_set_overflow(p, 0, NULL, NULL));
+    oscar_get_stats(p, &st);
+    ASSERT(st.bytes > fixed_bytes + 192 * sizeof(uint64_t));
+
+    /* Keep a few fixed cells and one overflow cell: the overflow can only
+     * shrink down to that. */
+    s.roots[10] = 200;
+    s.root_count = 11;
+    ASSERT_EQ(0, oscar_collect(p));
+    ASSERT_EQ(201, oscar_count(p));
+    ASSERT_EQ(1200, *(uint64_t *) oscar_get(p, 200));
+    ASSERT_EQ(2, s.warnings);
+    ASSERT_EQ(0, s.above);
+    ASSERT_EQ(11, s.live);
+
+    s.root_count = 10;
+    ASSERT_EQ(0, oscar_force_gc(p));
+    ASSERT_EQ(n, oscar_count(p));
+    oscar_get_stats(p, &st);
+    ASSERT_EQ(fixed_bytes, st.bytes);
+    for (int i=0; i<10; i++) {
+        ASSERT_EQ(1000 + i, *(uint64_t *) oscar_get(p, (pool_id) i));
+    }
+    ASSERT_EQ(10, oscar_alloc(p));
+    ASSERT_EQ(2, s.warnings);
+    oscar_free(p);
+    PASS();
+}
+
+/* Check that oscar_gc_needed looks past the sweep index: once only
+ * live cells are left ahead of it, a collection is needed, and the
+ * next oscar_alloc does collect. */
+TEST gc_needed_past_live() {
+    spill_state s;
+    memset(&s, 0, sizeof(s));
+    oscar *p = oscar_new(sizeof(link), 64, oscar_generic_mem_cb, NULL,
+        mark_spill_roots, &s, NULL, NULL);
+    ASSERT(p);
+    size_t n = oscar_count(p);
+    for (size_t i=n - 8; i<n; i++) s.roots[s.root_count++] = (pool_id) i;
+    ASSERT_EQ(0, oscar_collect(p));
+
+    for (size_t i=0; i<n - 9; i++) ASSERT_EQ(i, oscar_try_alloc(p));
+    ASSERT_EQ(0, oscar_gc_needed(p));
+    ASSERT_EQ(n - 9, oscar_try_alloc(p));
+    ASSERT(oscar_gc_needed(p));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_try_alloc(p));
+
+    oscar_stats st;
+    oscar_get_stats(p, &st);
+    size_t collections = st.collections;
+    ASSERT(oscar_alloc(p) != OSCAR_ID_NONE);
+    oscar_get_stats(p, &st);
+    ASSERT_EQ(collections + 1, st.collections);
+
+    oscar_free(p);
+    PASS();
+}
+
+/* Group test cells: a chain of nodes in one pool, each pointing at a
+ * blob in another pool, which points back at its node. */
+typedef struct gnode { pool_id next, blob; } gnode;
+typedef struct gblob { pool_id owner; char data[64 - sizeof(pool_id)]; } gblob;
+
+typedef struct group_state {
+    pool_id root;
+    int marks;                  /* mark_cb calls */
+} group_state;
+
+static int group_mark(oscar_group *g, void *udata) {
+    group_state *s = (group_state *) udata;
+    s->marks++;
+    for (pool_id id = s->root; id != OSCAR_ID_NONE; ) {
+        gnode *n = (gnode *) oscar_group_get(g, id);
+        oscar_group_mark(g, id);
+        oscar_group_mark(g, n->blob);
+        id = n->next;
+    }
+    return 0;
+}
+
+/* Check that pools in a group collect together from one traversal,
+ * and keep cells reachable only through the other pool. */
+TEST group_cross_refs() {
+    group_state s = { OSCAR_ID_NONE, 0 };
+    oscar_group *g = oscar_group_new(oscar_generic_mem_cb, NULL,
+        group_mark, &s);
+    ASSERT(g);
+    oscar *nodes = oscar_new(sizeof(gnode), 4, oscar_generic_mem_cb, NULL,
+        mark_from_zero, NULL, NULL, NULL);
+    oscar *blobs = oscar_new(sizeof(gblob), 4, oscar_generic_mem_cb, NULL,
+        mark_from_zero, NULL, NULL, NULL);
+    ASSERT(nodes && blobs);
+    ASSERT_EQ(0, oscar_group_add(g, nodes));
+    ASSERT_EQ(1, oscar_group_add(g, blobs));
+    ASSERT_EQ(blobs, oscar_group_pool(g, 1));
+
+    /* Build a chain of 20 nodes, each owning a blob. */
+    for (int i=0; i<20; i++) {
+        pool_id n = oscar_group_alloc(g, 0);
+        ASSERT_EQ(0, oscar_group_tag(n));
+        gnode *node = (gnode *) oscar_group_get(g, n);
+        node->next = s.root;
+        node->blob = OSCAR_ID_NONE;
+        s.root = n;
+        pool_id b = oscar_group_alloc(g, 1);
+        ASSERT_EQ(1, oscar_group_tag(b));
+        ((gblob *) oscar_group_get(g, b))->owner = n;
+        ((gnode *) oscar_group_get(g, n))->blob = b;
+    }
+
+    /* Churn through garbage blobs, making the blob pool collect. */
+    s.marks = 0;
+    for (int i=0; i<1000; i++) ASSERT(oscar_group_alloc(g, 1) != OSCAR_ID_NONE);
+    ASSERT(s.marks > 0);
+    ASSERT_EQ(0, oscar_group_force_gc(g));
+
+    int count = 0;
+    for (pool_id id = s.root; id != OSCAR_ID_NONE; count++) {
+        gnode *n = (gnode *) oscar_group_get(g, id);
+        ASSERT_EQ(id, ((gblob *) oscar_group_get(g, n->blob))->owner);
+        id = n->next;
+    }
+    ASSERT_EQ(20, count);
+
+    oscar_group_free(g);
+    PASS();
+}
+
+static void count_watermark(oscar *p, size_t live, int above, void *udata) {
+    spill_state *s = (spill_state *) udata;
+    s->warnings++;
+    s->above = above;
+    s->live = live;
+}
+
+/* Count the GC_BEGIN and GC_END records in trace F, which must name no
+ * cells (so it has no other records with arguments). */
+static void count_gc_records(FILE *f, int *begins, int *ends) {
+    int c = 0;
+    *begins = *ends = 0;
+    rewind(f);
+    for (int i=0; i<9; i++) (void) fgetc(f);    /* magic and version */
+    for (int i=0; i<2; i++) while ((c = fgetc(f)) & 0x80) {}
+    while ((c = fgetc(f)) != EOF) {
+        if (c == OSCAR_TRACE_GC_BEGIN) (*begins)++;
+        if (c != OSCAR_TRACE_GC_END) continue;
+        (*ends)++;
+        while (fgetc(f) & 0x80) {}
+    }
+}
+
+/* Check that a pool in a group finishes every collection the group
+ * makes, even when another pool started it: the trace has an end for
+ * every beginning, and the watermark is checked. */
+TEST group_member_finishes() {
+    group_state s = { OSCAR_ID_NONE, 0 };
+    oscar_group *g = oscar_group_new(oscar_generic_mem_cb, NULL,
+        group_mark, &s);
+    ASSERT(g);
+    oscar *nodes = oscar_new(sizeof(gnode), 32, oscar_generic_mem_cb, NULL,
+        mark_from_zero, NULL, NULL, NULL);
+    oscar *blobs = oscar_new(sizeof(gblob), 4, oscar_generic_mem_cb, NULL,
+        mark_from_zero, NULL, NULL, NULL);
+    ASSERT(nodes && blobs);
+    ASSERT_EQ(0, oscar_group_add(g, nodes));
+    ASSERT_EQ(1, oscar_group_add(g, blobs));
+    for (int i=0; i<20; i++) {
+        pool_id n = oscar_group_alloc(g, 0);
+        gnode *node = (gnode *) oscar_group_get(g, n);
+        node->next = s.root;
+        node->blob = OSCAR_ID_NONE;
+        s.root = n;
+    }
+
+    spill_state w;
+    memset(&w, 0, sizeof(w));
+    oscar_set_watermark(nodes, 10, count_watermark, &w);
+    FILE *f = tmpfile();
+    ASSERT(f);
+    ASSERT_EQ(0, oscar_trace_start(nodes, f));
+
+    /* Only the blob pool fills up. */
+    s.marks = 0;
+    for (int i=0; i<100; i++) ASSERT(oscar_group_alloc(g, 1) != OSCAR_ID_NONE);
+    ASSERT(s.marks > 0);
+    ASSERT_EQ(1, w.warnings);
+    ASSERT_EQ(1, w.above);
+    ASSERT_EQ(20, w.live);
+
+    int begins = 0, ends = 0;
+    ASSERT_EQ(0, oscar_trace_stop(nodes));
+    count_gc_records(f, &begins, &ends);
+    ASSERT_EQ(s.marks, begins);
+    ASSERT_EQ(begins, ends);
+
+    /* A forced collection finishes every pool the same way. */
+    fclose(f);
+    f = tmpfile();
+    ASSERT(f);
+    ASSERT_EQ(0, oscar_trace_start(nodes, f));
+    s.root = OSCAR_ID_NONE;
+    ASSERT_EQ(0, oscar_group_force_gc(g));
+    ASSERT_EQ(2, w.warnings);
+    ASSERT_EQ(0, w.above);
+    ASSERT_EQ(0, oscar_trace_stop(nodes));
+    count_gc_records(f, &begins, &ends);
+    ASSERT_EQ(1, begins);
+    ASSERT_EQ(1, ends);
+
+    fclose(f);
+    oscar_group_free(g);
+    PASS();
+}
+
+/* Profile a list that stays live (site 1) among garbage that dies
+ * young (site 2), and check the survival histogram and per-site counts. */
+TEST profile_lifetimes() {
+    int zero_is_live = 1;
+    oscar *p = oscar_new(sizeof(link), 256, oscar_generic_mem_cb, NULL,
+        mark_from_zero, &zero_is_live, NULL, NULL);
+    ASSERT(p);
+    ASSERT_EQ(0, oscar_profile_start(p, 1));
+
+    oscar_profile_site(p, 1);
+    ASSERT(build_list(p, 19));
+    oscar_profile_site(p, 2);
+    for (int i=0; i<50; i++) ASSERT(oscar_alloc(p) != OSCAR_ID_NONE);
+    for (int i=0; i<3; i++) ASSERT_EQ(0, oscar_force_gc(p));
+
+    oscar_profile_report r;
+    ASSERT_EQ(0, oscar_profile_get(p, &r));
+    ASSERT_EQ(70, r.sampled);
+    ASSERT_EQ(50, r.swept);
+    ASSERT_EQ(50, r.survival[0]);
+    ASSERT_EQ(20, r.site_sampled[1]);
+    ASSERT_EQ(20, r.site_retained[1]);
+    ASSERT_EQ(50, r.site_sampled[2]);
+    ASSERT_EQ(0, r.site_retained[2]);
+
+    /* Drop the list: it survived 3 collections (bucket 2: 2-3). */
+    zero_is_live = 0;
+    ASSERT_EQ(0, oscar_force_gc(p));
+    ASSERT_EQ(0, oscar_profile_get(p, &r));
+    ASSERT_EQ(20, r.survival[2]);
+    ASSERT_EQ(0, r.site_retained[1]);
+
+    oscar_stats stats;
+    oscar_get_stats(p, &stats);
+    ASSERT_EQ(4, stats.collections);
+
+    /* Deaths are counted by the collection that finds them, before the
+     * lazy sweep gets to the cells, and only once. */
+    ASSERT_EQ(0, oscar_profile_start(p, 1));
+    for (int i=0; i<30; i++) ASSERT(oscar_alloc(p) != OSCAR_ID_NONE);
+    for (int i=0; i<4; i++) {
+        ASSERT_EQ(0, oscar_collect(p));
+        ASSERT_EQ(0, oscar_profile_get(p, &r));
+        ASSERT_EQ(30, r.swept);
+        ASSERT_EQ(30, r.survival[0]);
+    }
+
+    /* Sampling 1 in 10 only records a tenth. */
+    ASSERT_EQ(0, oscar_profile_start(p, 10));
+    for (int i=0; i<100; i++) ASSERT(oscar_alloc(p) != OSCAR_ID_NONE);
+    ASSERT_EQ(0, oscar_profile_get(p, &r));
+    ASSERT_EQ(10, r.sampled);
+
+    oscar_free(p);
+    PASS();
+}
+
+/* Check that cells released by a scope count as swept samples, and
+ * that sparse samples of heavy churn are all accounted for. */
+TEST profile_scopes_and_churn() {
+    int zero_is_live = 0;
+    oscar *p = oscar_new(sizeof(link), 64, oscar_generic_mem_cb, NULL,
+        mark_from_zero, &zero_is_live, NULL, NULL);
+    ASSERT(p);
+    ASSERT_EQ(0, oscar_profile_start(p, 1));
+    oscar_profile_site(p, 3);
+
+    oscar_scope scope;
+    ASSERT_EQ(0, oscar_scope_begin(p, &scope, 8));
+    for (int i=0; i<3; i++) ASSERT(oscar_scope_alloc(&scope) != OSCAR_ID_NONE);
+    oscar_profile_report r;
+    ASSERT_EQ(0, oscar_profile_get(p, &r));
+    ASSERT_EQ(1, r.sampled);    /* the reservation, as one span */
+    ASSERT_EQ(1, r.site_retained[3]);
+    oscar_scope_end(&scope);
+    ASSERT_EQ(0, oscar_profile_get(p, &r));
+    ASSERT_EQ(1, r.swept);
+    ASSERT_EQ(1, r.survival[0]);
+    ASSERT_EQ(0, r.site_retained[3]);
+
+    oscar_free(p);
+
+    /* Many samples live at once, swept and replaced every collection. */
+    p = oscar_new(sizeof(link), 4096, oscar_generic_mem_cb, NULL,
+        mark_from_zero, &zero_is_live, NULL, NULL);
+    ASSERT(p);
+    ASSERT_EQ(0, oscar_profile_start(p, 3));
+    for (int i=0; i<30000; i++) ASSERT(oscar_alloc(p) != OSCAR_ID_NONE);
+    ASSERT_EQ(0, oscar_force_gc(p));
+    ASSERT_EQ(0, oscar_profile_get(p, &r));
+    ASSERT_EQ(30000 / 3, r.sampled);
+    ASSERT_EQ(r.sampled, r.swept);
+    ASSERT_EQ(0, r.site_retained[0]);
+
+    oscar_free(p);
+    PASS();
+}
+
+/* Ephemeron callback: mark the rest of the list VALUE starts. */
+static int mark_chain(oscar *p, pool_id value, void *udata) {
+    pool_id id = ((link *) oscar_get(p, value))->n;
+    (void) udata;
+    while (id != 0) {
+        oscar_mark(p, id);
+        id = ((link *) oscar_get(p, id))->n;
+    }
+    return 0;
+}
+
+/* Weak refs to dead cells are cleared, and ephemeron values live exactly
+ * as long as their keys, including keys only reached through another
+ * ephemeron's value. */
+TEST weak_refs_and_ephemerons() {
+    int zero_is_live = 1;
+    int freed[16];
+    bzero(freed, sizeof(freed));
+    oscar *p = oscar_new(sizeof(link), 16, oscar_generic_mem_cb, NULL,
+        mark_from_zero, &zero_is_live, basic_free_hook, freed);
+    ASSERT(p);
+    oscar_set_ephemeron_cb(p, mark_chain, NULL);
+    ASSERT(build_list(p, 2));   /* 0 -> 1 -> 2 */
+    for (int i=3; i<9; i++) ASSERT_EQ(i, oscar_alloc(p));
+    ((link *) oscar_get(p, 5))->n = 6;
+
+    oscar_weak_ref w_live, w_dead, w_none, w_rel;
+    oscar_weak_init(p, &w_live, 2);
+    oscar_weak_init(p, &w_rel, 4);
+    oscar_weak_init(p, &w_dead, 3);
+    oscar_weak_init(p, &w_none, OSCAR_ID_NONE);
+    oscar_weak_release(&w_rel);
+    oscar_weak_set(&w_rel, 4);  /* no longer cleared */
+
+    oscar_ephemeron e1, e2, e3;
+    oscar_ephemeron_init(p, &e1, 1, 5);
+    oscar_ephemeron_init(p, &e2, 6, 7);
+    oscar_ephemeron_init(p, &e3, 3, 8);
+
+    bzero(freed, sizeof(freed)); /* allocating sweeps fresh cells too */
+    ASSERT_EQ(0, oscar_force_gc(p));
+    ASSERT_EQ(2, oscar_weak_get(&w_live));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_weak_get(&w_dead));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_weak_get(&w_none));
+    ASSERT_EQ(4, oscar_weak_get(&w_rel));
+    ASSERT_EQ(1, oscar_ephemeron_key(&e1));
+    ASSERT_EQ(5, oscar_ephemeron_value(&e1));
+    ASSERT_EQ(6, oscar_ephemeron_key(&e2));
+    ASSERT_EQ(7, oscar_ephemeron_value(&e2));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_ephemeron_key(&e3));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_ephemeron_value(&e3));
+    for (int i=0; i<9; i++) ASSERT_EQ(i == 3 || i == 4 || i == 8, freed[i]);
+
+    /* Once the list is dropped, so is everything hanging off it. */
+    zero_is_live = 0;
+    ASSERT_EQ(0, oscar_collect(p));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_weak_get(&w_live));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_ephemeron_value(&e1));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_ephemeron_key(&e2));
+
+    /* A scope releasing cells clears whatever refers to them right
+     * away, but not to the cells escaping it. */
+    oscar_scope scope;
+    ASSERT_EQ(0, oscar_scope_begin(p, &scope, 4));
+    pool_id a = oscar_scope_alloc(&scope), b = oscar_scope_alloc(&scope);
+    ASSERT(a != OSCAR_ID_NONE && b != OSCAR_ID_NONE);
+    oscar_scope_escape(&scope, b);
+    oscar_weak_set(&w_live, a);
+    oscar_weak_set(&w_dead, b);
+    oscar_ephemeron_release(&e1);
+    oscar_ephemeron_init(p, &e1, b, a);
+    oscar_ephemeron_release(&e2);
+    oscar_ephemeron_init(p, &e2, b, b);
+    oscar_scope_end(&scope);
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_weak_get(&w_live));
+    ASSERT_EQ(b, oscar_weak_get(&w_dead));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_ephemeron_key(&e1));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_ephemeron_value(&e1));
+    ASSERT_EQ(b, oscar_ephemeron_key(&e2));
+    ASSERT_EQ(b, oscar_ephemeron_value(&e2));
+
+    oscar_ephemeron_release(&e2);
+    oscar_ephemeron_release(&e1);
+    oscar_ephemeron_release(&e3);
+    oscar_free(p);
+    PASS();
+}
+
+/* One of two pools driven in lockstep by epoch_marks_match_plain.
+ * Cells refer to each other by ID + 1, so zeroed cells refer to none. */
+typedef struct twin_cell { pool_id next, tag; } twin_cell;
+
+typedef struct twin {
+    oscar *p;
+    pool_id roots[32];
+    oscar_scope scope;
+    int scope_open;
+    pool_id scope_cells[8];     /* cells handed out by SCOPE */
+    size_t scope_count;
+    size_t frees;
+    uint64_t freed_sum;         /* sum of swept IDs + 1 */
+} twin;
+
+/* Mark the chain from ID only while it's newly marked, so a cell that
+ * wrongly looked marked would leave the rest of it unmarked. */
+static void twin_trace(oscar *p, pool_id id) {
+    while (id != OSCAR_ID_NONE && oscar_mark_inline(p, id)) {
+        id = ((twin_cell *) oscar_get(p, id))->next - 1;
+    }
+}
+
+static int twin_mark(oscar *p, void *udata) {
+    twin *t = (twin *) udata;
+    for (int i=0; i<32; i++) twin_trace(p, t->roots[i]);
+    /* The open scope is kept alive, but what it refers to isn't. */
+    for (size_t i=0; t->scope_open && i<t->scope_count; i++) {
+        twin_trace(p, ((twin_cell *) oscar_get(p, t->scope_cells[i]))->next - 1);
+    }
+    return 0;
+}
+
+static void twin_free(oscar *p, pool_id id, void *udata) {
+    twin *t = (twin *) udata;
+    t->frees++;
+    t->freed_sum += id + 1;
+}
+
+/* Apply operation OP to T, using ARG for its details. Returns the ID
+ * of any new cell, or OSCAR_ID_NONE. */
+static pool_id twin_step(twin *t, unsigned int op, unsigned int arg) {
+    pool_id id = OSCAR_ID_NONE;
+    twin_cell *c = NULL;
+    switch (op) {
+    case 12:
+        id = oscar_alloc_span(t->p, 2 + arg % 6);
+        break;
+    case 13:
+        (void) oscar_collect(t->p);
+        return OSCAR_ID_NONE;
+    case 14:
+        (void) oscar_sweep_step(t->p, arg % 64);
+        return OSCAR_ID_NONE;
+    case 15:
+        if (t->scope_open) {
+            oscar_scope_end(&t->scope);
+            t->scope_open = 0;
+        } else if (oscar_scope_begin(t->p, &t->scope, 8) == 0) {
+            t->scope_open = 1;
+            t->scope_count = 0;
+        }
+        return OSCAR_ID_NONE;
+    case 16:                    /* a scope cell, kept past the scope */
+        if (!t->scope_open) return OSCAR_ID_NONE;
+        id = oscar_scope_alloc(&t->scope);
+        if (id == OSCAR_ID_NONE) return id;
+        oscar_scope_escape(&t->scope, id);
+        t->scope_cells[t->scope_count++] = id;
+        break;
+    default:
+        id = oscar_alloc(t->p);
+        break;
+    }
+    if (id == OSCAR_ID_NONE) return id;
+    c = (twin_cell *) oscar_get(t->p, id);
+    c->next = t->roots[arg % 32] + 1;
+    c->tag = 1;
+    t->roots[(arg / 32) % 32] = id;
+    return id;
+}
+
+/* Every cell reachable from T's roots should still be tagged. */
+static int twin_check(twin *t) {
+    for (int i=0; i<32; i++) {
+        pool_id id = t->roots[i];
+        for (int n=0; id != OSCAR_ID_NONE && n < 1000; n++) {
+            twin_cell *c = (twin_cell *) oscar_get(t->p, id);
+            if (c == NULL || c->tag != 1) return 0;
+            id = c->next - 1;
+        }
+    }
+    return 1;
+}
+
+/* Epoch marks only change how marks are reset, not which cells are
+ * reused, so a plain pool and an epoch pool put through the same mix of
+ * allocations, spans, scopes, and explicit collections should hand out
+ * the same IDs and sweep the same cells. Switching modes partway
+ * through shouldn't change that either. */
+TEST epoch_marks_match_plain() {
+    twin a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    for (int i=0; i<32; i++) a.roots[i] = b.roots[i] = OSCAR_ID_NONE;
+    a.p = oscar_new(sizeof(twin_cell), 64, oscar_generic_mem_cb, NULL,
+        twin_mark, &a, twin_free, &a);
+    b.p = oscar_new(sizeof(twin_cell), 64, oscar_generic_mem_cb, NULL,
+        twin_mark, &b, twin_free, &b);
+    ASSERT(a.p && b.p);
+    ASSERT_EQ(0, oscar_set_epoch_marks(b.p, 1));
+
+    uint64_t rng = 0x2545f4914f6cdd1dULL;
+    int flips = 0, epoch = 1;
+    for (int i=0; i<50000; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        unsigned int op = (unsigned int) (rng % 18);
+        unsigned int arg = (unsigned int) (rng >> 32);
+        if (op == 17) {         /* rarely, a full GC or a mode switch */
+            if (arg % 64 == 0) {
+                epoch = !epoch;
+                ASSERT_EQ(0, oscar_set_epoch_marks(b.p, epoch));
+            } else if (arg % 16 == 0) {
+                ASSERT_EQ(0, oscar_force_gc(a.p));
+                ASSERT_EQ(0, oscar_force_gc(b.p));
+            }
+            continue;
+        }
+        uint64_t flip = b.p->mark_flip;
+        ASSERT_EQ(twin_step(&a, op, arg), twin_step(&b, op, arg));
+        if (b.p->mark_flip != flip) flips++;
+        ASSERT_EQ(a.frees, b.frees);
+        ASSERT_EQ(a.freed_sum, b.freed_sum);
+        if (i % 100 == 0) {
+            ASSERT(twin_check(&a));
+            ASSERT(twin_check(&b));
+        }
+    }
+    ASSERT_EQ(oscar_count(a.p), oscar_count(b.p));
+    ASSERT(flips > 10);
+
+    if (a.scope_open) oscar_scope_end(&a.scope);
+    if (b.scope_open) oscar_scope_end(&b.scope);
+    oscar_free(a.p);
+    oscar_free(b.p);
+    PASS();
+}
+
+#define STRESS_ROOTS 64
+
+/* A reference to a stress_node, with the serial number it had when the
+ * reference was made, so a cell swept and reused meanwhile is caught. */
+typedef struct stress_ref {
+    pool_id id;
+    uint64_t serial;
+} stress_ref;
+
+typedef struct stress_node {
+    uint64_t serial;            /* 0 once swept */
+    stress_ref edge[2];
+} stress_node;
+
+typedef struct stress {
+    stress_ref roots[STRESS_ROOTS];
+    uint64_t rng;
+    uint64_t serials;
+    unsigned int *seen;         /* visit stamps, by ID */
+    size_t seen_sz;
+    unsigned int stamp;
+    int direct_marks;           /* mark with oscar_concurrent_mark */
+} stress;
+
+static const stress_ref stress_none = { OSCAR_ID_NONE, 0 };
+
+static uint64_t stress_rand(stress *s) {  /* xorshift64 */
+    s->rng ^= s->rng << 13;
+    s->rng ^= s->rng >> 7;
+    s->rng ^= s->rng << 17;
+    return s->rng;
+}
+
+static int stress_mark_roots(oscar *p, void *udata) {
+    stress *s = (stress *) udata;
+    for (int i=0; i<STRESS_ROOTS; i++) {
+        if (s->roots[i].id == OSCAR_ID_NONE) continue;
+        if (s->direct_marks) {
+            (void) oscar_concurrent_mark(p, s->roots[i].id);
+        } else {
+            oscar_mark(p, s->roots[i].id);
+        }
+    }
+    return 0;
+}
+
+static int stress_scan(oscar *p, pool_id id, void *udata) {
+    stress *s = (stress *) udata;
+    stress_node *n = (stress_node *) oscar_get(p, id);
+    for (volatile int delay=0; delay<1000; delay++) {} /* widen races */
+    for (int e=0; e<2; e++) {
+        pool_id to = n->edge[e].id;
+        if (to == OSCAR_ID_NONE) continue;
+        if (s->direct_marks) {
+            (void) oscar_concurrent_mark(p, to);
+        } else {
+            oscar_mark(p, to);
+        }
+    }
+    return 0;
+}
+
+/* Follow a few random edges from REF, and return where that ends up. */
+static stress_ref stress_walk(oscar *p, stress *s, stress_ref ref) {
+    for (int step=0; ref.id != OSCAR_ID_NONE && step<8; step++) {
+        stress_node *n = (stress_node *) oscar_get(p, ref.id);
+        stress_ref next = n->edge[stress_rand(s) % 2];
+        if (next.id == OSCAR_ID_NONE) break;
+        ref = next;
+    }
+    return ref;
+}
+
+/* Walk everything reachable from the roots, and check none of it has
+ * been swept (or swept and reused). */
+static int stress_check(oscar *p, stress *s) {
+    stress_ref *stack = malloc((2 * oscar_count(p) + STRESS_ROOTS)
+        * sizeof(stress_ref));
+    size_t top = 0;
+    int ok = 1;
+    if (s->seen_sz < oscar_count(p)) {
+        s->seen = realloc(s->seen, oscar_count(p) * sizeof(unsigned int));
+        memset(s->seen + s->seen_sz, 0,
+            (oscar_count(p) - s->seen_sz) * sizeof(unsigned int));
+        s->seen_sz = oscar_count(p);
+    }
+    s->stamp++;
+    for (int i=0; i<STRESS_ROOTS; i++) {
+        if (s->roots[i].id != OSCAR_ID_NONE) stack[top++] = s->roots[i];
+    }
+    while (top > 0) {
+        stress_ref ref = stack[--top];
+        stress_node *n = (stress_node *) oscar_get(p, ref.id);
+        if (n->serial != ref.serial) {
+            ok = 0;
+            break;
+        }
+        if (s->seen[ref.id] == s->stamp) continue;
+        s->seen[ref.id] = s->stamp;
+        for (int e=0; e<2; e++) {
+            if (n->edge[e].id != OSCAR_ID_NONE) stack[top++] = n->edge[e];
+        }
+    }
+    free(stack);
+    return ok;
+}
+
+/* Randomly allocate, link, and drop cells while a collector thread
+ * marks, checking that nothing reachable is ever swept. DIRECT_MARKS
+ * marks with oscar_concurrent_mark, rather than oscar_mark. */
+TEST concurrent_mark_stress(int direct_marks) {
+    stress s;
+    memset(&s, 0, sizeof(s));
+    s.rng = 88172645463325252ULL;
+    s.direct_marks = direct_marks;
+    for (int i=0; i<STRESS_ROOTS; i++) s.roots[i] = stress_none;
+    oscar *p = oscar_new(sizeof(stress_node), 1024, oscar_generic_mem_cb,
+        NULL, stress_mark_roots, &s, NULL, NULL);
+    ASSERT(p);
+    ASSERT_EQ(0, oscar_concurrent_start(p, stress_scan, &s));
+
+    for (int i=0; i<200000; i++) {
+        int k = (int) (stress_rand(&s) % STRESS_ROOTS);
+        switch (stress_rand(&s) % 16) {
+        case 0: case 1: case 2: case 3: case 4: case 5: case 6: {
+            /* new cell, maybe in front of a root */
+            pool_id id = oscar_alloc(p);
+            ASSERT(id != OSCAR_ID_NONE);
+            stress_node *n = (stress_node *) oscar_get(p, id);
+            n->serial = ++s.serials;
+            n->edge[0] = (stress_rand(&s) % 2 ? s.roots[k] : stress_none);
+            n->edge[1] = stress_none;
+            s.roots[k].id = id;
+            s.roots[k].serial = n->serial;
+            break;
+        }
+        case 7: case 8: case 9: case 10: case 11: case 12: case 13:
+        case 14: {              /* repoint an edge somewhere reachable */
+            stress_ref from = s.roots[stress_rand(&s) % STRESS_ROOTS];
+            stress_ref to = stress_walk(p, &s, from);
+            stress_ref at = stress_walk(p, &s, s.roots[k]);
+            if (at.id == OSCAR_ID_NONE) break;
+            stress_node *n = (stress_node *) oscar_get(p, at.id);
+            int e = (int) (stress_rand(&s) % 2);
+            oscar_write_barrier(p, n->edge[e].id);
+            n->edge[e] = to;
+            break;
+        }
+        default:                /* drop a root */
+            s.roots[k] = stress_none;
+            break;
+        }
+        if (i % 100 == 0) ASSERTm("live cell swept", stress_check(p, &s));
+    }
+
+    oscar_concurrent_stats stats;
+    ASSERT_EQ(0, oscar_concurrent_get_stats(p, &stats));
+    ASSERT(stats.cycles > 0);
+    ASSERT(stats.black_allocs > 0);
+    ASSERT(stats.max_remark_ns > 0);
+    ASSERT_EQ(0, oscar_concurrent_stop(p));
+    ASSERT_EQ(-1, oscar_concurrent_get_stats(p, &stats));
+    ASSERTm("live cell swept", stress_check(p, &s));
+
+    free(s.seen);
+    oscar_free(p);
+    PASS();
+}
+
+/* Trace a short list being built and collected, and check the
+ * recorded bytes. Cells are named by allocation number in the trace. */
+TEST trace_records() {
+    int zero_is_live = 1;
+    oscar *p = oscar_new(sizeof(link), 4, oscar_generic_mem_cb, NULL,
+        mark_from_zero, &zero_is_live, NULL, NULL);
+    ASSERT(p);
+    oscar_trace_write(p, 0, 0, 0); /* not tracing: ignored */
+    FILE *f = tmpfile();
+    ASSERT(f);
+    ASSERT_EQ(0, oscar_trace_start(p, f));
+
+    for (int i=0; i<3; i++) ASSERT_EQ(i, oscar_alloc(p));
+    for (int i=0; i<3; i++) {
+        link *l = (link *) oscar_get(p, i);
+        l->n = (i + 1) % 3;
+        oscar_trace_write(p, i, 0, i < 2 ? (pool_id) (i + 1) : OSCAR_ID_NONE);
+    }
+    ASSERT_EQ(0, oscar_force_gc(p));
+    ASSERT_EQ(0, oscar_trace_stop(p));
+
+    unsigned char expected[] = {
+        'O', 'S', 'C', 'A', 'R', 'T', 'R', 'C', OSCAR_TRACE_VERSION,
+        sizeof(link), 4,
+        OSCAR_TRACE_ALLOC, OSCAR_TRACE_ALLOC, OSCAR_TRACE_ALLOC,
+        OSCAR_TRACE_WRITE, 0, 0, 2,
+        OSCAR_TRACE_WRITE, 1, 0, 3,
+        OSCAR_TRACE_WRITE, 2, 0, 0,
+        OSCAR_TRACE_GC_BEGIN,
+        OSCAR_TRACE_MARK, 0, OSCAR_TRACE_MARK, 1, OSCAR_TRACE_MARK, 2,
+        OSCAR_TRACE_GC_END, 4,
+    };
+    unsigned char buf[sizeof(expected) + 1];
+    rewind(f);
+    ASSERT_EQ(sizeof(expected), fread(buf, 1, sizeof(buf), f));
+    ASSERT_EQ(0, memcmp(expected, buf, sizeof(expected)));
+
+    fclose(f);
+    oscar_free(p);
+    PASS();
+}
+
+/* Mark the list of links from cell 0 (ending at 0) with
+ * oscar_mark_inline, or only cell 0 with oscar_concurrent_mark if
+ * UDATA is set, leaving the rest to scan_link. */
+static int mark_list_inline(oscar *p, void *udata) {
+    pool_id id = 0;
+    if (udata) {
+        (void) oscar_concurrent_mark(p, 0);
+        return 0;
+    }
+    do {
+        (void) oscar_mark_inline(p, id);
+        id = ((link *) oscar_get(p, id))->n;
+    } while (id != 0);
+    return 0;
+}
+
+static int scan_link(oscar *p, pool_id id, void *udata) {
+    pool_id next = ((link *) oscar_get(p, id))->n;
+    (void) udata;
+    if (next != 0) (void) oscar_concurrent_mark(p, next);
+    return 0;
+}
+
+/* Check that marks are traced however they were made: with
+ * oscar_mark_inline, or on the collector thread if CONCURRENT. */
+TEST trace_records_all_marks(int concurrent) {
+    oscar *p = oscar_new(sizeof(link), 64, oscar_generic_mem_cb, NULL,
+        mark_list_inline, concurrent ? &concurrent : NULL, NULL, NULL);
+    ASSERT(p);
+    if (concurrent) ASSERT_EQ(0, oscar_concurrent_start(p, scan_link, NULL));
+    FILE *f = tmpfile();
+    ASSERT(f);
+    ASSERT_EQ(0, oscar_trace_start(p, f));
+    for (int i=0; i<3; i++) {
+        ASSERT_EQ(i, oscar_alloc(p));
+        ((link *) oscar_get(p, i))->n = (pool_id) ((i + 1) % 3);
+    }
+    ASSERT_EQ(0, oscar_collect(p));
+    ASSERT_EQ(0, oscar_trace_stop(p));
+
+    unsigned char expected[] = {
+        'O', 'S', 'C', 'A', 'R', 'T', 'R', 'C', OSCAR_TRACE_VERSION,
+        sizeof(link), 64,
+        OSCAR_TRACE_ALLOC, OSCAR_TRACE_ALLOC, OSCAR_TRACE_ALLOC,
+        OSCAR_TRACE_GC_BEGIN,
+        OSCAR_TRACE_MARK, 0, OSCAR_TRACE_MARK, 1, OSCAR_TRACE_MARK, 2,
+        OSCAR_TRACE_GC_END, 64,
+    };
+    unsigned char buf[sizeof(expected) + 1];
+    rewind(f);
+    ASSERT_EQ(sizeof(expected), fread(buf, 1, sizeof(buf), f));
+    ASSERT_EQ(0, memcmp(expected, buf, sizeof(expected)));
+
+    fclose(f);
+    if (concurrent) ASSERT_EQ(0, oscar_concurrent_stop(p));
+    oscar_free(p);
+    PASS();
+}
+
+/* Record a trace with two reference slots per 16-byte cell, then
+ * replay it with oscar_replay (if built) on the dynamic and fixed
+ * backends. Cell sizes the replay works out or is given must be
+ * rounded up to ones oscar accepts. */
+TEST trace_replays() {
+    static const char *path = "test_replay.trc";
+    static const char *args[] = { "", "-b fixed -n 1024", "-c 20" };
+    FILE *bin = fopen("oscar_replay", "rb");
+    if (bin == NULL) SKIPm("oscar_replay not built");
+    fclose(bin);
+
+    int zero_is_live = 1;
+    oscar *p = oscar_new(sizeof(link), 4, oscar_generic_mem_cb, NULL,
+        mark_from_zero, &zero_is_live, NULL, NULL);
+    ASSERT(p);
+    FILE *f = fopen(path, "wb");
+    ASSERT(f);
+    ASSERT_EQ(0, oscar_trace_start(p, f));
+    pool_id last = oscar_alloc(p);
+    ASSERT_EQ(0, last);
+    for (int i=0; i<300; i++) {
+        pool_id id = oscar_alloc(p);
+        ASSERT(id != OSCAR_ID_NONE);
+        ((link *) oscar_get(p, last))->n = id;
+        oscar_trace_write(p, last, 0, id);
+        oscar_trace_write(p, id, 1, 0);
+        last = id;
+    }
+    ASSERT_EQ(0, oscar_trace_stop(p));
+    fclose(f);
+    oscar_free(p);
+
+    for (size_t i=0; i<sizeof(args) / sizeof(args[0]); i++) {
+        char cmd[128];
+        snprintf(cmd, sizeof(cmd), "./oscar_replay %s %s > /dev/null",
+            args[i], path);
+        ASSERTm(cmd, system(cmd) == 0);
+    }
+    remove(path);
+    PASS();
+}
+
+/* Snapshot a pool, restore it from the file, and check that the
+ * restored pool has the same contents and keeps working as it grows. */
+TEST snapshot_restore() {
+    int zero_is_live = 1;
+    oscar *p = oscar_new(sizeof(link), 2, oscar_generic_mem_cb, NULL,
+        mark_from_zero, &zero_is_live, NULL, NULL);
+    ASSERT(p);
+    ASSERT(build_list(p, 1000));
+
+    FILE *f = tmpfile();
+    ASSERT(f);
+    int fd = fileno(f);
+    ASSERT_EQ(0, oscar_snapshot(p, fd));
+
+    oscar *r = oscar_restore(fd, mark_from_zero, &zero_is_live, NULL, NULL);
+    ASSERT(r);
+    ASSERT_EQ(oscar_count(p), oscar_count(r));
+    ASSERT_EQ(1, check(r, 0, 0));
+
+    /* Writes to the restored pool are private to it. */
+    ((link *) oscar_get(r, 1))->d = (void *) 12345;
+    ASSERT_EQ(1, check(p, 0, 0));
+    ((link *) oscar_get(r, 1))->d = (void *) 1;
+
+    /* Fill the restored pool, so it has to move off the file mapping. */
+    size_t count = oscar_count(r);
+    for (size_t i=0; i<count; i++) ASSERT(oscar_alloc(r) != OSCAR_ID_NONE);
+    ASSERT(oscar_count(r) > count);
+    ASSERT_EQ(1, check(r, 0, 0));
+    oscar_free(r);
+
+    /* A corrupt header is rejected. */
+    ASSERT_EQ(0, fseek(f, 0, SEEK_SET));
+    ASSERT_EQ('X', fputc('X', f));
+    ASSERT_EQ(0, fflush(f));
+    ASSERT_EQ(NULL, oscar_restore(fd, mark_from_zero, &zero_is_live,
+            NULL, NULL));
+
+    /* Nor can a pool be snapshotted in the middle of a concurrent
+     * cycle, while its mark bits are still changing. */
+    ASSERT_EQ(0, oscar_concurrent_start(p, scan_link, NULL));
+    for (size_t i=0; i<oscar_count(p) && !oscar_concurrent_marking(p); i++) {
+        ASSERT(oscar_alloc(p) != OSCAR_ID_NONE);
+    }
+    ASSERT(oscar_concurrent_marking(p));
+    ASSERT(oscar_snapshot(p, fd) < 0);
+    ASSERT_EQ(0, oscar_collect(p));
+    ASSERT_EQ(0, oscar_snapshot(p, fd));
+    ASSERT_EQ(0, oscar_concurrent_stop(p));
+
+    fclose(f);
+    oscar_free(p);
+    PASS();
+}
+
+/* Check that oscar_force_gc leaves live cells as they were, and that
+ * the lazy sweep afterward only hands out the cells it swept. */
+TEST force_gc_keeps_live() {
+    int zero_is_live = 1;
+    oscar *p = oscar_new(sizeof(link), 8, oscar_generic_mem_cb, NULL,
+        mark_from_zero, &zero_is_live, NULL, NULL);
+    ASSERT(p);
+    size_t count = oscar_count(p);
+    for (int i=0; i<3; i++) {   /* [0] -> [1] -> [2] */
+        ASSERT_EQ(i, oscar_alloc(p));
+        link *l = (link *) oscar_get(p, i);
+        l->d = (void *) (intptr_t) (100 + i);
+        l->n = (i < 2 ? i + 1 : 0);
+    }
+    for (int i=0; i<2; i++) {   /* garbage */
+        link *l = (link *) oscar_get(p, oscar_alloc(p));
+        l->d = (void *) (intptr_t) 1;
+    }
+    ASSERT_EQ(0, oscar_force_gc(p));
+
+    for (size_t i=3; i<count; i++) {
+        pool_id id = oscar_alloc(p);
+        ASSERT(id >= 3 && id < count);
+        ASSERT_EQ(NULL, ((link *) oscar_get(p, id))->d);
+    }
+    for (int i=0; i<3; i++) {
+        ASSERT_EQ((void *) (intptr_t) (100 + i), ((link *) oscar_get(p, i))->d);
+    }
+
+    oscar_free(p);
+    PASS();
+}
+
+/* Memory callback that hands out small allocations (such as the pool
+ * struct), but refuses large ones, recording the largest size asked for. */
+static void *refuse_large_mem_cb(void *p, size_t old_sz,
+                                 size_t new_sz, void *udata) {
+    size_t *requested = (size_t *) udata;
+    if (new_sz == 0) { free(p); return NULL; }
+    if (new_sz <= 4096) return realloc(p, new_sz);
+    if (new_sz > *requested) *requested = new_sz;
+    return NULL;
+}
+
+/* Attach a reader to a shared pool, and check that it sees the writer's
+ * cells in place, can't allocate, and catches up after growth. */
+TEST shared_pool() {
+    int zero_is_live = 1;
+    oscar *w = oscar_new_shared(NULL, sizeof(link), 2,
+        mark_from_zero, &zero_is_live, NULL, NULL);
+    if (w == NULL) SKIPm("no memfd_create");
+    ASSERT(build_list(w, 100));
+
+    oscar *r = oscar_attach_shared(oscar_shared_fd(w));
+    ASSERT(r);
+    ASSERT_EQ(oscar_count(w), oscar_count(r));
+    ASSERT_EQ(1, check(r, 0, 0));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_alloc(r));
+    ASSERT(oscar_force_gc(r) < 0);
+
+    /* None of these may touch the read-only cells, or reset the sweep
+     * so that a later oscar_alloc would. */
+    oscar_scope scope;
+    ASSERT(oscar_collect(r) < 0);
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_alloc(r));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_alloc_span(r, 4));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_alloc(r));
+    ASSERT(oscar_scope_begin(r, &scope, 4) < 0);
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_alloc(r));
+    ASSERT_EQ(0, oscar_sweep_step(r, 100));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_alloc(r));
+    ASSERT(oscar_set_epoch_marks(r, 1) < 0);
+    ASSERT(oscar_force_gc(r) < 0);
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_try_alloc(r));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_alloc(r));
+    ASSERT_EQ(1, check(r, 0, 0));
+
+    /* Writes show up without copying. */
+    ((link *) oscar_get(w, 1))->d = (void *) 12345;
+    ASSERT_EQ((void *) 12345, ((link *) oscar_get(r, 1))->d);
+    ((link *) oscar_get(w, 1))->d = (void *) 1;
+
+    uint64_t gen = oscar_shared_generation(r);
+    ASSERT_EQ(gen, oscar_shared_generation(w));
+    ASSERT_EQ(0, oscar_force_gc(w));
+    ASSERT(oscar_shared_generation(r) > gen);
+
+    /* Cells released by a scope can be reused right away, so releasing
+     * them starts a new generation too. */
+    ASSERT_EQ(0, oscar_scope_begin(w, &scope, 4));
+    ASSERT(oscar_scope_alloc(&scope) != OSCAR_ID_NONE);
+    gen = oscar_shared_generation(r);
+    oscar_scope_end(&scope);
+    ASSERT(oscar_shared_generation(r) > gen);
+
+    /* Fill the writer so it grows; the reader sees it after syncing. */
+    size_t count = oscar_count(w);
+    for (size_t i=0; i<count; i++) ASSERT(oscar_alloc(w) != OSCAR_ID_NONE);
+    ASSERT(oscar_count(w) > count);
+    ASSERT_EQ(count, oscar_count(r));
+    ASSERT_EQ(0, oscar_shared_sync(r));
+    ASSERT_EQ(oscar_count(w), oscar_count(r));
+    ASSERT_EQ(1, check(r, 0, 0));
+    ASSERT_EQ(OSCAR_ID_NONE, oscar_alloc(r));
+
+    oscar_free(r);
+    ASSERT_EQ(1, check(w, 0, 0));
+    oscar_free(w);
+    PASS();
+}
+
+/* Check that sizes past 4 GB are computed without wrapping. */
+TEST large_size_arithmetic() {
+    if (SIZE_MAX <= UINT32_MAX) SKIPm("32-bit size_t");
+    size_t requested = 0;
+    size_t count = ((size_t) 1 << 26) + 1;    /* 64 * count > 2^32 */
+    oscar *p = oscar_new(64, count, refuse_large_mem_cb, &requested,
+        mark_from_zero, NULL, NULL, NULL);
+    ASSERT_EQ(NULL, p);
+    ASSERT_EQ(64 * count, requested);
+    PASS();
+}
+
+/* Check that a pool too large for size_t is rejected before allocating. */
+TEST size_overflow() {
+    size_t requested = 0;
+    size_t cell_sz = (SIZE_MAX / 2) & ~(sizeof(void *) - 1);
+    oscar *p = oscar_new(cell_sz, 4, refuse_large_mem_cb, &requested,
+        mark_from_zero, NULL, NULL, NULL);
+    ASSERT_EQ(NULL, p);
+    ASSERT_EQ(0, requested);
+    PASS();
+}
+
+/* Check that a pool of more than 2^32 cells is only allowed
+ * when pool_id is wide enough to address all of them. */
+TEST wide_ids() {
+    if (SIZE_MAX <= UINT32_MAX) SKIPm("32-bit size_t");
+    size_t requested = 0;
+    size_t count = ((size_t) 1 << 32) + 1;
+    oscar *p = oscar_new(8, count, refuse_large_mem_cb, &requested,
+        mark_from_zero, NULL, NULL, NULL);
+    ASSERT_EQ(NULL, p);
+    if (sizeof(pool_id) < 8) {
+        ASSERT_EQ(0, requested);
+    } else {
+        ASSERT_EQ(8 * count, requested);
+    }
+    PASS();
+}
+
+/* Memory callback using reserve-only anonymous mappings, so address
+ * space isn't backed until touched. Doesn't support resizing. */
+static void *mmap_mem_cb(void *p, size_t old_sz,
+                         size_t new_sz, void *udata) {
+    if (p == NULL) {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+        flags |= MAP_NORESERVE;
+#endif
+        p = mmap(NULL, new_sz, PROT_READ | PROT_WRITE, flags, -1, 0);
+        return (p == MAP_FAILED ? NULL : p);
+    }
+    if (new_sz == 0) munmap(p, old_sz);
+    return NULL;
+}
+
+static int mark_last(oscar *p, void *udata) {
+    oscar_mark(p, oscar_count(p) - 1);
+    return 0;
+}
+
+/* Build a pool with more than 2^32 bytes of cells and use its far end.
+ * Zeroing the pool commits over 4 GB, so this only runs when
+ * OSCAR_TEST_BIG is set in the environment. */
+TEST big_pool() {
+    if (SIZE_MAX <= UINT32_MAX) SKIPm("32-bit size_t");
+    if (getenv("OSCAR_TEST_BIG") == NULL) SKIPm("OSCAR_TEST_BIG not set");
+    size_t count = ((size_t) 1 << 26) + 1;
+    oscar *p = oscar_new(64, count, mmap_mem_cb, NULL,
+        mark_last, NULL, NULL, NULL);
+    ASSERT(p);
+    ASSERT_EQ(count, oscar_count(p));
+    char *first = (char *) oscar_get(p, 0);
+    char *last = (char *) oscar_get(p, count - 1);
+    ASSERT(first && last);
+    ASSERT_EQ(64 * (count - 1), (size_t) (last - first));
+    last[63] = 'x';
+    ASSERT_EQ(0, oscar_force_gc(p));
+    ASSERT_EQ(0, oscar_alloc(p));
+    oscar_free(p);
+    PASS();
+}
+
 SUITE(suite) {
     for (int i=0; i<8; i++) {
         int pad = i*sizeof(void *);
@@ -272,6 +1954,36 @@ SUITE(suite) {
         RUN_TESTp(growth, pad);
     }
     RUN_TEST(fixed_small);
+    RUN_TEST(fixed_overflow_spill);
+    RUN_TEST(gc_needed_past_live);
+    RUN_TEST(inline_accessors);
+    RUN_TEST(force_gc_keeps_live);
+    RUN_TESTp(aligned_cells, sizeof(void *));
+    RUN_TESTp(aligned_cells, OSCAR_CACHE_LINE);
+    RUN_TEST(heap_classes);
+    RUN_TEST(group_cross_refs);
+    RUN_TEST(group_member_finishes);
+    RUN_TEST(hugepage_pool);
+    RUN_TEST(span_arrays);
+    RUN_TEST(scoped_alloc);
+    RUN_TEST(live_iteration);
+    RUN_TEST(scheduled_gc);
+    RUN_TEST(profile_lifetimes);
+    RUN_TEST(profile_scopes_and_churn);
+    RUN_TEST(trace_records);
+    RUN_TESTp(trace_records_all_marks, 0);
+    RUN_TESTp(trace_records_all_marks, 1);
+    RUN_TEST(trace_replays);
+    RUN_TEST(weak_refs_and_ephemerons);
+    RUN_TEST(epoch_marks_match_plain);
+    RUN_TESTp(concurrent_mark_stress, 0);
+    RUN_TESTp(concurrent_mark_stress, 1);
+    RUN_TEST(snapshot_restore);
+    RUN_TEST(shared_pool);
+    RUN_TEST(large_size_arithmetic);
+    RUN_TEST(size_overflow);
+    RUN_TEST(wide_ids);
+    RUN_TEST(big_pool);
 }
 
 GREATEST_MAIN_DEFS();
@@ -0,0 +1,150 @@
+/* For copyright notice, see oscar.h. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* The C headers can be included on either side of oscar.hpp. */
+#include "oscar.h"
+#include "oscar_group.h"
+#include "oscar.hpp"
+#include "oscar_heap.h"
+#include "oscar_mmap.h"
+#include "greatest.h"
+
+struct node {
+    int value;
+    oscarpp::handle<node> left;
+    oscarpp::handle<node> right;
+};
+
+static int finalized = 0;
+
+struct node_hooks {
+    template<typename Pool>
+    static void trace(const node &n, Pool &p) {
+        if (n.left.valid()) p.mark(n.left);
+        if (n.right.valid()) p.mark(n.right);
+    }
+    static void finalize(node &n) { if (n.value != 0) finalized++; }
+};
+
+typedef oscarpp::pool<node, node_hooks> node_pool;
+
+/* Check that the cell size is a compile-time constant. */
+static_assert(node_pool::cell_size == 16, "node cells should be 16 bytes");
+
+/* Check that alloc returns value-initialized cells, and that
+ * handles index them like the C API does. */
+TEST typed_alloc() {
+    node_pool p(4);
+    oscarpp::handle<node> h = p.alloc();
+    ASSERT(h.valid());
+    node *n = p.get(h);
+    ASSERT(n);
+    ASSERT_EQ(0, n->value);
+    ASSERT(!n->left.valid());
+    ASSERT_EQ(oscar_get(p.raw(), h.id), (void *) n);
+    ASSERT_EQ(n, &p[h]);
+    ASSERT_EQ(NULL, p.get(oscarpp::handle<node>(p.count())));
+    PASS();
+}
+
+/* A cell type aligned past oscar's default. */
+struct alignas(64) wide {
+    uint64_t lanes[4];
+};
+
+/* Check that over-aligned cells land on their alignment, both in the
+ * initial cells and after the pool grows, and that the C API can be
+ * used on the same pool. */
+TEST over_aligned_cells() {
+    oscarpp::pool<wide> p(2);
+    static_assert(oscarpp::pool<wide>::cell_size == 64, "one line per cell");
+    oscarpp::pool<wide>::root_scope s(p);
+    for (int i = 0; i < 20; i++) {
+        oscarpp::handle<wide> h = s.add(p.alloc());
+        ASSERT(h.valid());
+        ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(p.get(h)) % 64);
+    }
+    ASSERT(p.count() >= 20);
+    oscar_stats st;
+    oscar_get_stats(p.raw(), &st);
+    ASSERT_EQ(p.count(), st.count);
+    PASS();
+}
+
+/* Build a binary tree of DEPTH levels under ROOT. */
+static oscarpp::handle<node> build(node_pool &p, node_pool::root_scope &s,
+                                 int depth) {
+    oscarpp::handle<node> h = s.add(p.alloc());
+    p[h].value = depth;
+    if (depth > 1) {
+        oscarpp::handle<node> l = build(p, s, depth - 1);
+        oscarpp::handle<node> r = build(p, s, depth - 1);
+        p[h].left = l;
+        p[h].right = r;
+    }
+    return h;
+}
+
+/* Check that cells reachable from a root scope survive collection,
+ * and are finalized once the scope ends. */
+TEST root_scopes() {
+    node_pool p(2);
+    finalized = 0;
+    node_pool::root_scope outer(p);
+    oscarpp::handle<node> keep = outer.add(p.alloc());
+    p[keep].value = 100;
+    {
+        node_pool::root_scope inner(p);
+        oscarpp::handle<node> tree = build(p, inner, 8);   /* 255 nodes */
+        ASSERT_EQ(0, p.collect());
+        ASSERT_EQ(0, finalized);
+        ASSERT_EQ(8, p[tree].value);
+        ASSERT_EQ(7, p[p[tree].left].value);
+    }
+    ASSERT_EQ(0, p.collect());
+    ASSERT_EQ(255, finalized);
+    ASSERT_EQ(100, p[keep].value);
+    PASS();
+}
+
+/* Check that a long chain is traced without recursing per link. */
+TEST long_chain() {
+    node_pool p(2);
+    node_pool::root_scope s(p);
+    oscarpp::handle<node> head = s.add(p.alloc());
+    oscarpp::handle<node> last = head;
+    const int limit = 200000;
+    for (int i = 1; i <= limit; i++) {
+        oscarpp::handle<node> h = p.alloc();
+        ASSERT(h.valid());
+        p[h].value = i;
+        p[last].right = h;
+        last = h;
+    }
+    ASSERT_EQ(0, p.collect());
+    int seen = 0;
+    for (oscarpp::handle<node> h = p[head].right; h.valid(); h = p[h].right) {
+        ASSERT_EQ(++seen, p[h].value);
+    }
+    ASSERT_EQ(limit, seen);
+    PASS();
+}
+
+SUITE(suite) {
+    RUN_TEST(typed_alloc);
+    RUN_TEST(over_aligned_cells);
+    RUN_TEST(root_scopes);
+    RUN_TEST(long_chain);
+}
+
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}